@@ -4,92 +4,63 @@
 // Manually load and push the buckets in, plug in the board, and it will despense one bucket every 24 hours after that.
 // Tested with esp32 v3.0.3
 
-const int BUCKET_COUNT = 10;
-// Number of steps to take when extending the first bucket
-const int STEPS_FIRST_BUCKET = 430;
-// Number of steps to take when extending all other buckets
-const int STEPS_PER_BUCKET = 340;
+// Step sequence and bucket geometry are shared with the ESP-IDF firmware.  src/feeder_core.h is a symlink to
+// components/feeder_core/include/feeder_core.h; copy the file over it if your setup doesn't follow symlinks.
+#include "src/feeder_core.h"
 
 // 24 hours between feedings
-const int FEED_DELAY = 1000 * 60 * 60 * 24;
+const unsigned long FEED_DELAY_MS = 1000UL * 60 * 60 * 24;
 
-// Delay between each step in microseconds
-const int STEP_PERIOD_US = 5000;
+const unsigned long STEP_PERIOD_MS = FEEDER_STEP_PERIOD_US / 1000;
 
-const int STEP_COUNT = 4;
-const bool STEPS[STEP_COUNT][4] = {
-    {0, 0, 0, 1},
-    // {0, 0, 1, 1},
-    {0, 0, 1, 0},
-    // {0, 1, 1, 0},
-    {0, 1, 0, 0},
-    // {1, 1, 0, 0},
-    {1, 0, 0, 0},
-    // {1, 0, 0, 1},
+struct ArduinoIo {
+  static void output(uint8_t pin) { pinMode(pin, OUTPUT); }
+  static void write(uint8_t pin, bool level) { digitalWrite(pin, level ? HIGH : LOW); }
 };
 
-// This order pairs with the STEPS sequence.
-const int STEPPER_PINS[4] = {33, 25, 27, 14};
+// Pins in FEEDER_COIL_1..4 order.
+feeder::Stepper<ArduinoIo, 33, 25, 27, 14> stepper;
+int target = 0;
 
-int step_idx = 0;
-unsigned long last_step_time = 0;
-int extendedBucketCount = 0;
-
-/* 
+/*
 * Move the stepper motor a number of steps.
 * Positive steps for one direction, negative for the other.
-* This is very similar to the Arduino Stepper implementation only stepping one pin at a time rather than pairs.
+* Sleeps between steps instead of spinning, so the CPU idles for all but the pin writes.
 */
 static void step(int steps) {
-  int steps_left = abs(steps);
-  bool reversed = steps < 0;
-
-  while(steps_left > 0) {
-    unsigned long now = micros();
+  int direction = steps < 0 ? -1 : 1;
+  unsigned long next_step_ms = millis();
 
-    if(now - last_step_time >= STEP_PERIOD_US) {
-      digitalWrite(STEPPER_PINS[0], STEPS[step_idx][0]);
-      digitalWrite(STEPPER_PINS[1], STEPS[step_idx][1]);
-      digitalWrite(STEPPER_PINS[2], STEPS[step_idx][2]);
-      digitalWrite(STEPPER_PINS[3], STEPS[step_idx][3]);
+  for (int steps_left = abs(steps); steps_left > 0; steps_left--) {
+    stepper.step(direction);
 
-      steps_left--;
-
-      int next_step_idx = (reversed ? (step_idx + STEP_COUNT-1) : step_idx + 1) % STEP_COUNT;
-      step_idx = next_step_idx;
-      last_step_time = now;
-    } else {
-      yield();
+    next_step_ms += STEP_PERIOD_MS;
+    long wait_ms = (long)(next_step_ms - millis());
+    if (wait_ms > 0) {
+      delay(wait_ms);
     }
   }
 
-  digitalWrite(STEPPER_PINS[0], LOW);
-  digitalWrite(STEPPER_PINS[1], LOW);
-  digitalWrite(STEPPER_PINS[2], LOW);
-  digitalWrite(STEPPER_PINS[3], LOW);
+  stepper.release();
 }
 
 void setup() {
   Serial.begin(9600);
-
-  pinMode(STEPPER_PINS[0], OUTPUT);
-  pinMode(STEPPER_PINS[1], OUTPUT);
-  pinMode(STEPPER_PINS[2], OUTPUT);
-  pinMode(STEPPER_PINS[3], OUTPUT);
+  stepper.begin();
 
   Serial.println("Setup complete");
 }
 
 void loop() {
-  Serial.printf("Waiting for %dms\n", FEED_DELAY);
-  delay(FEED_DELAY);
+  Serial.printf("Waiting for %lums\n", FEED_DELAY_MS);
+  delay(FEED_DELAY_MS);
 
-  if(extendedBucketCount < BUCKET_COUNT) {
-    int stepCount = (extendedBucketCount == 0 ? STEPS_FIRST_BUCKET : STEPS_PER_BUCKET);
-    step(stepCount);
+  if (!feeder_all_buckets_extended(target, FEEDER_BUCKET_COUNT, FEEDER_STEPS_PER_BUCKET)) {
+    int next_target = feeder_next_bucket_target(target, FEEDER_FIRST_BUCKET_STEPS, FEEDER_STEPS_PER_BUCKET);
+    step(next_target - target);
+    target = next_target;
 
-    extendedBucketCount++;
-    Serial.printf("Extended bucket %d\n", extendedBucketCount);
+    Serial.printf("Extended bucket to %d steps\n", target);
   } else {
     Serial.println("All buckets extended");
   }
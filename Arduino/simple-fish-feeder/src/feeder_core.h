@@ -0,0 +1 @@
+../../../components/feeder_core/include/feeder_core.h
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "boot_stages.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define ALL_STAGES (BOOT_STAGE_BIT(BOOT_STAGE_COUNT) - 1)
+
+typedef struct {
+    int64_t begin_us;
+    int64_t done_us;
+    bool ok;
+} stage_timing_t;
+
+static const char *TAG = "BOOT";
+
+static const char *stage_names[BOOT_STAGE_COUNT] = {
+    [BOOT_STAGE_CONFIG] = "config",
+    [BOOT_STAGE_POWER] = "power",
+    [BOOT_STAGE_TELEMETRY] = "telemetry",
+    [BOOT_STAGE_MOTOR] = "motor",
+    [BOOT_STAGE_AUDIO] = "audio",
+    [BOOT_STAGE_TIME] = "time",
+};
+
+static EventGroupHandle_t stage_events;
+static StaticEventGroup_t stage_events_buffer;
+static stage_timing_t timings[BOOT_STAGE_COUNT];
+static bool summary_logged = false;
+
+void boot_stages_init()
+{
+    stage_events = xEventGroupCreateStatic(&stage_events_buffer);
+    ESP_LOGI(TAG, "app_main at %lld ms", esp_timer_get_time() / 1000);
+}
+
+void boot_stage_begin(boot_stage_t stage)
+{
+    timings[stage].begin_us = esp_timer_get_time();
+}
+
+static void finish_stage(boot_stage_t stage)
+{
+    EventBits_t bits = xEventGroupSetBits(stage_events, BOOT_STAGE_BIT(stage));
+    if ((bits & ALL_STAGES) == ALL_STAGES && !__atomic_exchange_n(&summary_logged, true, __ATOMIC_RELAXED))
+    {
+        int64_t last_us = 0;
+        for (int i = 0; i < BOOT_STAGE_COUNT; i++)
+        {
+            last_us = timings[i].done_us > last_us ? timings[i].done_us : last_us;
+        }
+        ESP_LOGI(TAG, "Boot complete at %lld ms, manual feeds accepted from %lld ms", last_us / 1000, timings[BOOT_STAGE_MOTOR].done_us / 1000);
+    }
+}
+
+void boot_stage_done(boot_stage_t stage, bool ok)
+{
+    // Each stage's timing is only written by the task running it, and read after its bit is set.
+    timings[stage].done_us = esp_timer_get_time();
+    timings[stage].ok = ok;
+
+    const stage_timing_t *timing = &timings[stage];
+    ESP_LOGI(TAG, "%-9s %s at %lld ms, took %lld ms", stage_names[stage], ok ? "ready" : "FAILED",
+             timing->done_us / 1000, (timing->done_us - timing->begin_us) / 1000);
+    finish_stage(stage);
+}
+
+void boot_stage_skip(boot_stage_t stage)
+{
+    timings[stage].begin_us = timings[stage].done_us = esp_timer_get_time();
+    timings[stage].ok = false;
+
+    ESP_LOGI(TAG, "%-9s skipped", stage_names[stage]);
+    finish_stage(stage);
+}
+
+bool boot_stages_wait(EventBits_t bits, TickType_t timeout)
+{
+    return (xEventGroupWaitBits(stage_events, bits, pdFALSE, pdTRUE, timeout) & bits) == bits;
+}
+
+bool boot_stage_ok(boot_stage_t stage)
+{
+    return (xEventGroupGetBits(stage_events) & BOOT_STAGE_BIT(stage)) && timings[stage].ok;
+}
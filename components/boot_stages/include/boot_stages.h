@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+// Init stages that run concurrently at boot.  Each stage reports when it starts and finishes, later stages wait
+// on the bits of the ones they depend on, and the timings are logged as they complete.
+typedef enum {
+    BOOT_STAGE_CONFIG = 0,
+    BOOT_STAGE_POWER,
+    BOOT_STAGE_TELEMETRY,
+    BOOT_STAGE_MOTOR,
+    BOOT_STAGE_AUDIO,
+    BOOT_STAGE_TIME,
+    BOOT_STAGE_COUNT,
+} boot_stage_t;
+
+#define BOOT_STAGE_BIT(stage) ((EventBits_t)1 << (stage))
+
+// Call first thing in app_main, before any stage begins.
+void boot_stages_init();
+
+void boot_stage_begin(boot_stage_t stage);
+
+// Marks the stage finished, successfully or not, and wakes anything waiting on it.
+void boot_stage_done(boot_stage_t stage, bool ok);
+
+// Marks a stage that is not needed on this boot as finished, without success.
+void boot_stage_skip(boot_stage_t stage);
+
+// Blocks until every stage in bits has finished.  False on timeout.
+bool boot_stages_wait(EventBits_t bits, TickType_t timeout);
+
+bool boot_stage_ok(boot_stage_t stage);
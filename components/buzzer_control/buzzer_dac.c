@@ -1,4 +1,5 @@
 #include "buzzer_control.h"
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/dac_cosine.h"
@@ -6,13 +7,24 @@
 #include "esp_check.h"
 #include <math.h>
 #include "esp_timer.h"
+#include "esp_pm.h"
+#include "trace.h"
+#include "energy.h"
 
 #define CONST_PERIOD_2_PI           6.2832
 
 #define EXAMPLE_ARRAY_LEN       400
 #define EXAMPLE_DAC_AMPLITUDE   255
-#define EXAMPLE_WAVE_FREQ_HZ    2000                      // Default wave frequency 2000 Hz, it can't be too low
-#define EXAMPLE_CONVERT_FREQ_HZ (EXAMPLE_ARRAY_LEN * EXAMPLE_WAVE_FREQ_HZ) // The frequency that DAC convert every data in the wave array
+#define DAC_CONVERT_FREQ_HZ     100000                    // Fixed conversion rate, the pitch comes from the wave buffer
+#define WAVE_BUF_LEN            4000                      // Lowest playable tone is DAC_CONVERT_FREQ_HZ / WAVE_BUF_LEN
+
+#define BUZZER_TASK_STACK_SIZE 2048
+#if CONFIG_TRACE_ENABLE
+// Keeps the cycle timestamps of trace entries at the rate the decoder assumes while a note plays.
+#define BUZZER_PM_LOCK ESP_PM_CPU_FREQ_MAX
+#else
+#define BUZZER_PM_LOCK ESP_PM_NO_LIGHT_SLEEP
+#endif
 
 #define TASK_N_QUIT (1ULL << 1)
 #define TASK_N_RESET (1ULL << 2)
@@ -22,11 +34,16 @@ uint8_t sin_wav[EXAMPLE_ARRAY_LEN];
 dac_continuous_handle_t cont_handle;
 
 static const char *TAG = "BUZZER_CONTROL";
+static uint8_t wave_buf[WAVE_BUF_LEN];
+static bool dac_playing = false;
 static buzzer_pattern_t *current_pattern = NULL;
 static buzzer_keyframe_t *current_keyframe = NULL;
 static int current_keyframe_idx = 0;
 static int64_t next_frame_time_us;
 static TaskHandle_t buzzer_task_handle;
+static StackType_t buzzer_task_stack[BUZZER_TASK_STACK_SIZE];
+static StaticTask_t buzzer_task_buffer;
+static esp_pm_lock_handle_t buzzer_pm_lock;
 
 
 static void gen_approx_wavs()
@@ -37,32 +54,49 @@ static void gen_approx_wavs()
     }
 }
 
+// Fills wave_buf with as many whole periods of freq as fit, resampled from sin_wav. Returns the sample count.
+static size_t fill_wave_buf(uint16_t freq)
+{
+    uint32_t periods = (uint32_t)WAVE_BUF_LEN * freq / DAC_CONVERT_FREQ_HZ;
+    if (periods == 0)
+    {
+        periods = 1;
+        freq = DAC_CONVERT_FREQ_HZ / WAVE_BUF_LEN;
+    }
+
+    size_t len = ((uint64_t)periods * DAC_CONVERT_FREQ_HZ + freq / 2) / freq;
+    if (len > WAVE_BUF_LEN)
+    {
+        len = WAVE_BUF_LEN;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        wave_buf[i] = sin_wav[(uint64_t)i * periods * EXAMPLE_ARRAY_LEN / len % EXAMPLE_ARRAY_LEN];
+    }
+
+    return len;
+}
+
 static void buzzer_stop_play() {
-    if(cont_handle == NULL) {
+    if (!dac_playing) {
         return;
     }
 
     dac_continuous_disable(cont_handle);
-    dac_continuous_del_channels(cont_handle);
-    cont_handle = NULL;
+    dac_playing = false;
+    energy_end(ENERGY_STATE_DAC);
+    esp_pm_lock_release(buzzer_pm_lock);
 }
 
 static void buzzer_start_play(uint16_t freq) {
-    dac_continuous_config_t cont_cfg = {
-        .chan_mask = DAC_CHANNEL_MASK_CH1,
-        .desc_num = 8,
-        .buf_size = 2048,
-        .freq_hz = EXAMPLE_ARRAY_LEN * freq,
-        .offset = 0,
-        .clk_src = DAC_DIGI_CLK_SRC_DEFAULT,     // If the frequency is out of range, try 'DAC_DIGI_CLK_SRC_APLL'
-        .chan_mode = DAC_CHANNEL_MODE_SIMUL,
-    };
-    /* Allocate continuous channel */
-    ESP_ERROR_CHECK(dac_continuous_new_channels(&cont_cfg, &cont_handle));
-    /* Enable the channels in the group */
+    size_t len = fill_wave_buf(freq);
+
+    esp_pm_lock_acquire(buzzer_pm_lock);
     ESP_ERROR_CHECK(dac_continuous_enable(cont_handle));
-    
-    ESP_ERROR_CHECK(dac_continuous_write_cyclically(cont_handle, (uint8_t*) sin_wav, EXAMPLE_ARRAY_LEN, NULL));
+    ESP_ERROR_CHECK(dac_continuous_write_cyclically(cont_handle, wave_buf, len, NULL));
+    dac_playing = true;
+    energy_begin(ENERGY_STATE_DAC);
 }
 
 static bool increment_pattern_frame()
@@ -94,6 +128,18 @@ static bool increment_pattern_frame()
     return false;
 }
 
+static TickType_t ticks_until_next_frame()
+{
+    if (current_keyframe == NULL)
+    {
+        return portMAX_DELAY;
+    }
+
+    int64_t remaining_us = next_frame_time_us - esp_timer_get_time();
+
+    return remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 0;
+}
+
 static void buzzer_play_task(void *args)
 {
     uint32_t notification = 0;
@@ -102,7 +148,8 @@ static void buzzer_play_task(void *args)
 
     while (true)
     {
-        if (xTaskNotifyWait(1, 1, &notification, 10 / portTICK_PERIOD_MS))
+        // Sleep until the next keyframe is due, or indefinitely when nothing is playing.
+        if (xTaskNotifyWait(0, UINT32_MAX, &notification, ticks_until_next_frame()))
         {
             if (notification & TASK_N_QUIT)
             {
@@ -137,6 +184,8 @@ static void buzzer_play_task(void *args)
 
         if (changed_keyframe)
         {
+            // Timed, since the CPU may have been scaled down during the rest before it.
+            trace_record_timed(TRACE_EVT_KEYFRAME, current_keyframe != NULL ? current_keyframe->frequency : 0);
             buzzer_stop_play();
             vTaskDelay(10 / portTICK_PERIOD_MS);
 
@@ -160,7 +209,22 @@ static void buzzer_play_task(void *args)
 esp_err_t buzzer_control_init() {
     gen_approx_wavs();
 
-    xTaskCreate(buzzer_play_task, "Buzzer Task", 2048, NULL, 5, &buzzer_task_handle);
+    // Created once and only enabled per note, so playing does not touch the heap.
+    dac_continuous_config_t cont_cfg = {
+        .chan_mask = DAC_CHANNEL_MASK_CH1,
+        .desc_num = 8,
+        .buf_size = 2048,
+        .freq_hz = DAC_CONVERT_FREQ_HZ,
+        .offset = 0,
+        .clk_src = DAC_DIGI_CLK_SRC_DEFAULT,     // If the frequency is out of range, try 'DAC_DIGI_CLK_SRC_APLL'
+        .chan_mode = DAC_CHANNEL_MODE_SIMUL,
+    };
+    ESP_RETURN_ON_ERROR(dac_continuous_new_channels(&cont_cfg, &cont_handle), TAG, "Failed to create DAC channels");
+
+    esp_pm_lock_create(BUZZER_PM_LOCK, 0, "buzzer", &buzzer_pm_lock);
+
+    buzzer_task_handle = xTaskCreateStaticPinnedToCore(buzzer_play_task, "Buzzer Task", BUZZER_TASK_STACK_SIZE, NULL, CONFIG_BUZZER_TASK_PRIORITY,
+                                                       buzzer_task_stack, &buzzer_task_buffer, CONFIG_MOTOR_TASK_CORE);
 
     return ESP_OK;
 }
@@ -172,6 +236,11 @@ esp_err_t buzzer_control_play_pattern(buzzer_pattern_t* pattern) {
     return ESP_OK;
 }
 
+bool buzzer_control_is_playing()
+{
+    return current_keyframe != NULL || dac_playing;
+}
+
 void buzzer_control_deinit()
 {
     xTaskNotify(buzzer_task_handle, 1, eSetBits);
@@ -180,36 +180,31 @@ static esp_err_t parse_notes(const char* music_str, buzzer_keyframe_t* frames, i
     return ESP_OK;
 }
 
-esp_err_t buzzer_frequency_sweep(uint16_t start_freq, uint16_t end_freq, uint16_t step_count, uint16_t duration_ms, buzzer_pattern_t** pattern_out) {
-    buzzer_keyframe_t* frames = malloc(sizeof(buzzer_keyframe_t) * step_count);
-    
+esp_err_t buzzer_frequency_sweep(uint16_t start_freq, uint16_t end_freq, uint16_t step_count, uint16_t duration_ms, buzzer_pattern_t* pattern, buzzer_keyframe_t* frames) {
     for(int i=0; i<step_count; i++) {
         frames[i].duration = duration_ms / step_count,
         frames[i].frequency = ((end_freq - start_freq) * i / step_count) + start_freq;
     }
 
-    buzzer_pattern_t* pattern = malloc(sizeof(buzzer_pattern_t));
     pattern->key_frames = frames;
     pattern->frame_count = step_count;
 
-    *pattern_out = pattern;
-
     return ESP_OK;
 }
 
-esp_err_t parse_music_str(const char* music_str, buzzer_pattern_t** pattern_out) {
+esp_err_t parse_music_str(const char* music_str, buzzer_pattern_t* pattern, buzzer_keyframe_t* frames, int max_frames) {
     int note_count = get_note_count(music_str);
-    buzzer_keyframe_t* frames = malloc(sizeof(buzzer_keyframe_t) * note_count);
+    if (note_count > max_frames) {
+        ESP_LOGE(TAG, "%d notes do not fit in %d frames.", note_count, max_frames);
+        return ESP_ERR_INVALID_SIZE;
+    }
 
     if (parse_notes(music_str, frames, note_count) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    buzzer_pattern_t* pattern = malloc(sizeof(buzzer_pattern_t));
     pattern->key_frames = frames;
     pattern->frame_count = note_count;
 
-    *pattern_out = pattern;
-
     return ESP_OK;
 }
\ No newline at end of file
@@ -24,4 +24,7 @@ typedef struct {
 
 esp_err_t buzzer_control_init();
 
-esp_err_t buzzer_control_play_pattern(buzzer_pattern_t* pattern);
\ No newline at end of file
+esp_err_t buzzer_control_play_pattern(buzzer_pattern_t* pattern);
+
+// True while a pattern is playing or a note is still sounding.
+bool buzzer_control_is_playing();
\ No newline at end of file
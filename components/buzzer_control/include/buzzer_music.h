@@ -2,6 +2,10 @@
 
 #include "buzzer_control.h"
 
-esp_err_t parse_music_str(const char* music_str, buzzer_pattern_t** pattern_out);
+// Patterns are built in caller provided storage, so they can live in static memory.
 
-esp_err_t buzzer_frequency_sweep(uint16_t start_freq, uint16_t end_freq, uint16_t step_count, uint16_t duration_ms, buzzer_pattern_t** pattern_out);
+// Fails with ESP_ERR_INVALID_SIZE if the string has more than max_frames notes and rests.
+esp_err_t parse_music_str(const char* music_str, buzzer_pattern_t* pattern, buzzer_keyframe_t* frames, int max_frames);
+
+// frames must hold step_count keyframes.
+esp_err_t buzzer_frequency_sweep(uint16_t start_freq, uint16_t end_freq, uint16_t step_count, uint16_t duration_ms, buzzer_pattern_t* pattern, buzzer_keyframe_t* frames);
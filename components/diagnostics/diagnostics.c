@@ -0,0 +1,250 @@
+#include "diagnostics.h"
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include <string.h>
+#include "energy.h"
+
+#define MAX_TASKS 24
+// Room for every esp_sleep_wakeup_cause_t, anything past it is counted in the last slot.
+#define WAKE_CAUSES 16
+#define US_PER_HOUR 3600000000ULL
+// Changes with the layout, since the counts also carry over into a new image after an OTA update.
+#define WAKE_STATS_MAGIC (0x57414B45 ^ (uint32_t)sizeof(wake_stats_t))
+
+typedef struct {
+    uint32_t magic;
+    // Light sleep wakes in [0], deep sleep wakes in [1].
+    uint32_t counts[2][WAKE_CAUSES];
+    // Counts and energy clock as of the previous `wakeups` command.
+    uint32_t last_counts[WAKE_CAUSES];
+    uint64_t last_report_us;
+} wake_stats_t;
+
+static const char *TAG = "DIAGNOSTICS";
+
+static const char *wake_cause_names[WAKE_CAUSES] = {
+    [ESP_SLEEP_WAKEUP_UNDEFINED] = "undefined",
+    [ESP_SLEEP_WAKEUP_EXT0] = "ext0",
+    [ESP_SLEEP_WAKEUP_EXT1] = "ext1",
+    [ESP_SLEEP_WAKEUP_TIMER] = "timer",
+    [ESP_SLEEP_WAKEUP_TOUCHPAD] = "touchpad",
+    [ESP_SLEEP_WAKEUP_ULP] = "ulp",
+    [ESP_SLEEP_WAKEUP_GPIO] = "gpio",
+    [ESP_SLEEP_WAKEUP_UART] = "uart",
+    [ESP_SLEEP_WAKEUP_WIFI] = "wifi",
+};
+
+static uint32_t boot_free_heap = 0;
+// Kept through deep sleep and restarts like the energy totals, so the rates and their time base reset together.
+static RTC_NOINIT_ATTR wake_stats_t wake_stats;
+
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t task_status[MAX_TASKS];
+// task_status is shared by the scheduler's logging and the console.
+static SemaphoreHandle_t task_status_mutex;
+static StaticSemaphore_t task_status_mutex_buffer;
+#endif
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+typedef struct {
+    UBaseType_t number;
+    configRUN_TIME_COUNTER_TYPE runtime;
+} runtime_snapshot_t;
+
+// Run times as of the previous `tasks` command, so each report also covers just the time since then.
+static runtime_snapshot_t last_runtimes[MAX_TASKS];
+static UBaseType_t last_runtime_count;
+static configRUN_TIME_COUNTER_TYPE last_total_runtime;
+#endif
+
+void diagnostics_init()
+{
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    task_status_mutex = xSemaphoreCreateMutexStatic(&task_status_mutex_buffer);
+#endif
+    // After energy_init(), a report past the energy clock means the totals were just cleared.
+    energy_stats_t stats;
+    energy_get_stats(&stats);
+    if (wake_stats.magic != WAKE_STATS_MAGIC || esp_reset_reason() == ESP_RST_POWERON ||
+        wake_stats.last_report_us > stats.total_us)
+    {
+        memset(&wake_stats, 0, sizeof(wake_stats));
+        wake_stats.magic = WAKE_STATS_MAGIC;
+    }
+
+    if (esp_reset_reason() == ESP_RST_DEEPSLEEP)
+    {
+        diagnostics_record_wakeup(esp_sleep_get_wakeup_cause(), true);
+    }
+}
+
+void diagnostics_mark_boot()
+{
+    boot_free_heap = esp_get_free_heap_size();
+}
+
+void diagnostics_log_tasks()
+{
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    xSemaphoreTake(task_status_mutex, portMAX_DELAY);
+    UBaseType_t count = uxTaskGetSystemState(task_status, MAX_TASKS, NULL);
+    if (count == 0)
+    {
+        ESP_LOGW(TAG, "More than %d tasks, raise MAX_TASKS", MAX_TASKS);
+    }
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "%-16s prio %2u  min free stack %5lu bytes", task_status[i].pcTaskName,
+                 (unsigned)task_status[i].uxCurrentPriority, (unsigned long)task_status[i].usStackHighWaterMark);
+    }
+    xSemaphoreGive(task_status_mutex);
+#else
+    ESP_LOGW(TAG, "Per task stack usage needs CONFIG_FREERTOS_USE_TRACE_FACILITY");
+#endif
+
+    uint32_t free_heap = esp_get_free_heap_size();
+    ESP_LOGI(TAG, "Heap free %lu bytes, lowest %lu, %+ld since boot", free_heap, esp_get_minimum_free_heap_size(),
+             boot_free_heap != 0 ? (long)free_heap - (long)boot_free_heap : 0L);
+}
+
+void IRAM_ATTR diagnostics_record_wakeup(esp_sleep_wakeup_cause_t cause, bool deep)
+{
+    wake_stats.counts[deep ? 1 : 0][(unsigned)cause < WAKE_CAUSES ? cause : WAKE_CAUSES - 1]++;
+}
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static configRUN_TIME_COUNTER_TYPE last_runtime(UBaseType_t number)
+{
+    for (UBaseType_t i = 0; i < last_runtime_count; i++)
+    {
+        if (last_runtimes[i].number == number)
+        {
+            return last_runtimes[i].runtime;
+        }
+    }
+
+    return 0;
+}
+
+// Tenths of a percent, so printing needs no floats.
+static unsigned permille(uint64_t part, uint64_t whole)
+{
+    return whole != 0 ? part * 1000 / whole : 0;
+}
+#endif
+
+// CPU share is of one core, so the two idle tasks each approach 100% when the chip is mostly asleep.
+static int tasks_command(int argc, char **argv)
+{
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    xSemaphoreTake(task_status_mutex, portMAX_DELAY);
+    configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, MAX_TASKS, &total_runtime);
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    configRUN_TIME_COUNTER_TYPE interval = total_runtime - last_total_runtime;
+    printf("%-16s %5s %10s %10s %6s\n", "task", "prio", "cpu boot", "cpu last", "stack");
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t *status = &task_status[i];
+        unsigned since_boot = permille(status->ulRunTimeCounter, total_runtime);
+        unsigned since_last = permille(status->ulRunTimeCounter - last_runtime(status->xTaskNumber), interval);
+        printf("%-16s %5u %7u.%u%% %7u.%u%% %6lu\n", status->pcTaskName, (unsigned)status->uxCurrentPriority,
+               since_boot / 10, since_boot % 10, since_last / 10, since_last % 10, (unsigned long)status->usStackHighWaterMark);
+        last_runtimes[i] = (runtime_snapshot_t){.number = status->xTaskNumber, .runtime = status->ulRunTimeCounter};
+    }
+    last_runtime_count = count;
+    last_total_runtime = total_runtime;
+#else
+    printf("%-16s %5s %6s\n", "task", "prio", "stack");
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        printf("%-16s %5u %6lu\n", task_status[i].pcTaskName, (unsigned)task_status[i].uxCurrentPriority,
+               (unsigned long)task_status[i].usStackHighWaterMark);
+    }
+    printf("CPU use needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS\n");
+#endif
+    xSemaphoreGive(task_status_mutex);
+#else
+    printf("Needs CONFIG_FREERTOS_USE_TRACE_FACILITY\n");
+#endif
+
+    return 0;
+}
+
+// Tenths of a wakeup per hour.
+static unsigned hourly_rate(uint32_t count, uint64_t interval_us)
+{
+    return interval_us != 0 ? count * US_PER_HOUR * 10 / interval_us : 0;
+}
+
+// Rates are light and deep wakeups together, over the energy clock, which keeps running through deep sleep and is
+// only reset with the counts, on power on.
+static int wakeups_command(int argc, char **argv)
+{
+    energy_stats_t stats;
+    energy_get_stats(&stats);
+    uint64_t interval_us = stats.total_us - wake_stats.last_report_us;
+
+    printf("%-10s %10s %10s %10s %10s\n", "cause", "light", "deep", "/h boot", "/h last");
+    for (int i = 0; i < WAKE_CAUSES; i++)
+    {
+        uint32_t count = wake_stats.counts[0][i] + wake_stats.counts[1][i];
+        unsigned since_boot = hourly_rate(count, stats.total_us);
+        unsigned since_last = hourly_rate(count - wake_stats.last_counts[i], interval_us);
+        wake_stats.last_counts[i] = count;
+        if (count == 0)
+        {
+            continue;
+        }
+
+        if (wake_cause_names[i] != NULL)
+        {
+            printf("%-10s", wake_cause_names[i]);
+        }
+        else
+        {
+            printf("cause %-4d", i);
+        }
+        printf(" %10lu %10lu %8u.%u %8u.%u\n", wake_stats.counts[0][i], wake_stats.counts[1][i], since_boot / 10,
+               since_boot % 10, since_last / 10, since_last % 10);
+    }
+    wake_stats.last_report_us = stats.total_us;
+
+    return 0;
+}
+
+esp_err_t diagnostics_register_commands()
+{
+    const esp_console_cmd_t commands[] = {
+        {
+            .command = "tasks",
+            .help = "Per task CPU share since boot and since the last 'tasks', priority and least free stack",
+            .func = &tasks_command,
+        },
+        {
+            .command = "wakeups",
+            .help = "Light and deep sleep wakeups by cause, with hourly rates since power on and since the last 'wakeups'",
+            .func = &wakeups_command,
+        },
+    };
+
+    for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        esp_err_t err = esp_console_cmd_register(&commands[i]);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
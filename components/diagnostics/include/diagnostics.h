@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_sleep.h"
+
+// Counts this boot's wakeup if it came out of deep sleep.  Call once early in app_main, after energy_init().
+void diagnostics_init();
+
+// Remembers the free heap once boot has finished, so later reports show anything allocated since.
+void diagnostics_mark_boot();
+
+// Logs every task's stack high water mark (the least free stack it has had) and the heap headroom, for right
+// sizing the static task stacks.  Per task figures need CONFIG_FREERTOS_USE_TRACE_FACILITY.
+void diagnostics_log_tasks();
+
+// Counts a wakeup by cause.  Only bumps a counter, so it is fine from the light sleep exit callback.
+void diagnostics_record_wakeup(esp_sleep_wakeup_cause_t cause, bool deep);
+
+// Adds the `tasks` and `wakeups` console commands.
+esp_err_t diagnostics_register_commands();
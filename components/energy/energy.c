@@ -0,0 +1,187 @@
+#include "energy.h"
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <sys/time.h>
+
+// Changes with the layout, since the totals also carry over into a new image after an OTA update.
+#define ENERGY_MAGIC (0x454E5247 ^ (uint32_t)sizeof(energy_totals_t))
+#define UA_US_PER_MAH 3.6e12
+
+typedef struct {
+    uint32_t magic;
+    uint64_t total_us;
+    uint64_t state_us[ENERGY_STATE_COUNT];
+    // Wall clock when deep sleep started.  The RTC keeps time through it, unlike esp_timer.
+    int64_t deep_sleep_start_us;
+} energy_totals_t;
+
+static const char *TAG = "ENERGY";
+
+// Extra current on top of the awake baseline, except sleep which replaces it.
+static const uint32_t state_current_ua[ENERGY_STATE_COUNT] = {
+    [ENERGY_STATE_SLEEP] = CONFIG_ENERGY_SLEEP_UA,
+    [ENERGY_STATE_RADIO] = CONFIG_ENERGY_RADIO_UA,
+    [ENERGY_STATE_MOTOR] = CONFIG_ENERGY_MOTOR_UA,
+    [ENERGY_STATE_DAC] = CONFIG_ENERGY_DAC_UA,
+    [ENERGY_STATE_DEEP_SLEEP] = CONFIG_ENERGY_DEEP_SLEEP_UA,
+};
+
+static const char *state_names[ENERGY_STATE_COUNT] = {
+    [ENERGY_STATE_SLEEP] = "sleep",
+    [ENERGY_STATE_RADIO] = "radio",
+    [ENERGY_STATE_MOTOR] = "motor",
+    [ENERGY_STATE_DAC] = "dac",
+    [ENERGY_STATE_DEEP_SLEEP] = "deep",
+};
+
+static RTC_NOINIT_ATTR energy_totals_t totals;
+static portMUX_TYPE energy_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t checkpoint_us;
+static int64_t state_since_us[ENERGY_STATE_COUNT];
+static uint16_t state_level[ENERGY_STATE_COUNT];
+
+static int64_t wall_time_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t IRAM_ATTR scaled_us(energy_state_t state, int64_t since_us, int64_t now_us)
+{
+    return since_us != 0 ? (uint64_t)(now_us - since_us) * state_level[state] / ENERGY_LEVEL_FULL : 0;
+}
+
+static void IRAM_ATTR checkpoint(int64_t now_us)
+{
+    totals.total_us += now_us - checkpoint_us;
+    checkpoint_us = now_us;
+}
+
+void energy_init()
+{
+    if (totals.magic != ENERGY_MAGIC || esp_reset_reason() == ESP_RST_POWERON)
+    {
+        memset(&totals, 0, sizeof(totals));
+        totals.magic = ENERGY_MAGIC;
+    }
+    else if (esp_reset_reason() == ESP_RST_DEEPSLEEP && totals.deep_sleep_start_us != 0)
+    {
+        int64_t slept_us = wall_time_us() - totals.deep_sleep_start_us;
+        if (slept_us > 0)
+        {
+            totals.total_us += slept_us;
+            totals.state_us[ENERGY_STATE_DEEP_SLEEP] += slept_us;
+        }
+    }
+    totals.deep_sleep_start_us = 0;
+
+    memset(state_since_us, 0, sizeof(state_since_us));
+    for (int i = 0; i < ENERGY_STATE_COUNT; i++)
+    {
+        state_level[i] = ENERGY_LEVEL_FULL;
+    }
+    checkpoint_us = esp_timer_get_time();
+}
+
+void energy_prepare_deep_sleep()
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&energy_mux);
+    checkpoint(now_us);
+    totals.deep_sleep_start_us = wall_time_us();
+    portEXIT_CRITICAL(&energy_mux);
+}
+
+void IRAM_ATTR energy_begin(energy_state_t state)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&energy_mux);
+    if (state_since_us[state] == 0)
+    {
+        state_since_us[state] = now_us;
+    }
+    portEXIT_CRITICAL_SAFE(&energy_mux);
+}
+
+void IRAM_ATTR energy_end(energy_state_t state)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&energy_mux);
+    if (state_since_us[state] != 0)
+    {
+        totals.state_us[state] += scaled_us(state, state_since_us[state], now_us);
+        state_since_us[state] = 0;
+    }
+    checkpoint(now_us);
+    portEXIT_CRITICAL_SAFE(&energy_mux);
+}
+
+void IRAM_ATTR energy_set_level(energy_state_t state, uint16_t level_permille)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&energy_mux);
+    if (state_since_us[state] != 0 && state_level[state] != level_permille)
+    {
+        totals.state_us[state] += scaled_us(state, state_since_us[state], now_us);
+        state_since_us[state] = now_us;
+    }
+    state_level[state] = level_permille;
+    portEXIT_CRITICAL_SAFE(&energy_mux);
+}
+
+uint64_t energy_state_us(energy_state_t state)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&energy_mux);
+    uint64_t state_us = totals.state_us[state] + scaled_us(state, state_since_us[state], now_us);
+    portEXIT_CRITICAL(&energy_mux);
+
+    return state_us;
+}
+
+void energy_get_stats(energy_stats_t *stats)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&energy_mux);
+    checkpoint(now_us);
+    stats->total_us = totals.total_us;
+    for (int i = 0; i < ENERGY_STATE_COUNT; i++)
+    {
+        stats->state_us[i] = totals.state_us[i] + scaled_us(i, state_since_us[i], now_us);
+    }
+    portEXIT_CRITICAL(&energy_mux);
+
+    stats->awake_us = stats->total_us - stats->state_us[ENERGY_STATE_SLEEP] - stats->state_us[ENERGY_STATE_DEEP_SLEEP];
+    stats->awake_mah = stats->awake_us * (double)CONFIG_ENERGY_AWAKE_UA / UA_US_PER_MAH;
+    stats->total_mah = stats->awake_mah;
+    for (int i = 0; i < ENERGY_STATE_COUNT; i++)
+    {
+        stats->state_mah[i] = stats->state_us[i] * (double)state_current_ua[i] / UA_US_PER_MAH;
+        stats->total_mah += stats->state_mah[i];
+    }
+}
+
+void energy_log_stats()
+{
+    energy_stats_t stats;
+    energy_get_stats(&stats);
+
+    ESP_LOGI(TAG, "%.3f mAh over %llu s (awake %llu s, %.3f mAh)", stats.total_mah, stats.total_us / 1000000, stats.awake_us / 1000000, stats.awake_mah);
+    for (int i = 0; i < ENERGY_STATE_COUNT; i++)
+    {
+        ESP_LOGI(TAG, "  %-5s %llu ms, %.3f mAh", state_names[i], stats.state_us[i] / 1000, stats.state_mah[i]);
+    }
+}
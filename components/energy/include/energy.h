@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    ENERGY_STATE_SLEEP = 0,
+    ENERGY_STATE_RADIO,
+    ENERGY_STATE_MOTOR,
+    ENERGY_STATE_DAC,
+    ENERGY_STATE_DEEP_SLEEP,
+    ENERGY_STATE_COUNT,
+} energy_state_t;
+
+// Full current for a state, in permille.
+#define ENERGY_LEVEL_FULL 1000
+
+typedef struct {
+    uint64_t total_us;
+    uint64_t awake_us;
+    uint64_t state_us[ENERGY_STATE_COUNT];  // as if at full current, see energy_set_level()
+    double awake_mah;
+    double state_mah[ENERGY_STATE_COUNT];
+    double total_mah;
+} energy_stats_t;
+
+// Restores totals kept in RTC memory unless this is a power-on reset.  After a deep sleep, adds the time slept.
+void energy_init();
+
+// Call right before esp_deep_sleep_start().
+void energy_prepare_deep_sleep();
+
+// Begin/end are idempotent, so callers can report on every step or poll.  Safe from ISRs.
+void energy_begin(energy_state_t state);
+
+void energy_end(energy_state_t state);
+
+// Scales the current counted for a state from now on, for loads driven at part duty.  Also safe from ISRs.
+void energy_set_level(energy_state_t state, uint16_t level_permille);
+
+// Time so far in one state, scaled by its level, including any stretch still running.
+uint64_t energy_state_us(energy_state_t state);
+
+void energy_get_stats(energy_stats_t *stats);
+
+void energy_log_stats();
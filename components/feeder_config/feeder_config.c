@@ -0,0 +1,462 @@
+#include "feeder_config.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_console.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+#define CONFIG_NAMESPACE "feeder_cfg"
+#define CONFIG_KEY "config"
+#define MAX_CHANGE_CBS 4
+// Changes with the layout, so a copy left in RTC memory by other firmware is not trusted.
+#define RTC_CONFIG_MAGIC (0x46434647 ^ ((uint32_t)FEEDER_CONFIG_VERSION << 16) ^ (uint32_t)sizeof(feeder_config_t))
+#define ARRAY_LEN(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef enum {
+    FIELD_UINT16,
+    FIELD_HOUR_MINS,
+    FIELD_STRING,
+    FIELD_SECRET,
+} field_kind_t;
+
+// For numbers min and max bound the value, for strings min is the shortest allowed length.
+typedef struct {
+    const char *key;
+    field_kind_t kind;
+    size_t offset;
+    size_t size;
+    int min;
+    int max;
+} config_field_t;
+
+typedef struct {
+    uint32_t magic;
+    feeder_config_t config;
+} rtc_config_t;
+
+#define FIELD(name, kind, min, max) {#name, kind, offsetof(feeder_config_t, name), sizeof(((feeder_config_t *)0)->name), min, max}
+
+// Same ranges as main/Kconfig.projbuild.
+static const config_field_t fields[] = {
+    FIELD(feeding_time, FIELD_HOUR_MINS, 0, 2359),
+    FIELD(steps_per_bucket, FIELD_UINT16, 10, 10000),
+    FIELD(first_bucket_steps, FIELD_UINT16, 10, 10000),
+    FIELD(bucket_count, FIELD_UINT16, 1, 100),
+    FIELD(timezone, FIELD_STRING, 1, 0),
+    FIELD(wifi_ssid, FIELD_STRING, 1, 0),
+    FIELD(wifi_password, FIELD_SECRET, 0, 0),
+};
+
+static const char *TAG = "FEEDER_CONFIG";
+
+// One copy is live and the other is where the next update is put together.
+static feeder_config_t configs[2];
+static const feeder_config_t *volatile active_config = &configs[0];
+static SemaphoreHandle_t config_mutex;
+static StaticSemaphore_t config_mutex_buffer;
+static feeder_config_change_cb_t change_cbs[MAX_CHANGE_CBS];
+static int change_cb_count = 0;
+static bool nvs_ready = false;
+// A copy of the live settings, so a wake from deep sleep can start without touching NVS.
+static RTC_DATA_ATTR rtc_config_t rtc_config;
+
+// Call with the mutex held, or before any other task runs.
+static esp_err_t init_nvs()
+{
+    if (nvs_ready)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    nvs_ready = err == ESP_OK;
+
+    return err;
+}
+
+static void load_defaults(feeder_config_t *config)
+{
+    *config = (feeder_config_t){
+        .version = FEEDER_CONFIG_VERSION,
+        .feeding_time = CONFIG_FEEDING_TIME,
+        .steps_per_bucket = CONFIG_STEPS_PER_BUCKET,
+        .first_bucket_steps = CONFIG_FIRST_BUCKET_STEPS,
+        .bucket_count = CONFIG_BUCKET_COUNT,
+    };
+    strlcpy(config->timezone, CONFIG_TIMEZONE, sizeof(config->timezone));
+    strlcpy(config->wifi_ssid, CONFIG_WIFI_SSID, sizeof(config->wifi_ssid));
+    strlcpy(config->wifi_password, CONFIG_WIFI_PASSWORD, sizeof(config->wifi_password));
+}
+
+static bool field_valid(const feeder_config_t *config, const config_field_t *field)
+{
+    const uint8_t *value = (const uint8_t *)config + field->offset;
+    switch (field->kind)
+    {
+    case FIELD_HOUR_MINS:
+        if (*(const uint16_t *)value % 100 >= 60)
+        {
+            return false;
+        }
+        // fall through
+    case FIELD_UINT16:
+        return *(const uint16_t *)value >= field->min && *(const uint16_t *)value <= field->max;
+    default:
+    {
+        size_t len = strnlen((const char *)value, field->size);
+        return len < field->size && len >= (size_t)field->min;
+    }
+    }
+}
+
+static bool config_valid(const feeder_config_t *config)
+{
+    for (int i = 0; i < ARRAY_LEN(fields); i++)
+    {
+        if (!field_valid(config, &fields[i]))
+        {
+            ESP_LOGW(TAG, "Stored %s is out of range", fields[i].key);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static const config_field_t *find_field(const char *key, size_t key_len)
+{
+    for (int i = 0; i < ARRAY_LEN(fields); i++)
+    {
+        if (strlen(fields[i].key) == key_len && strncmp(fields[i].key, key, key_len) == 0)
+        {
+            return &fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+static esp_err_t apply_assignment(feeder_config_t *config, const char *assignment)
+{
+    const char *value = strchr(assignment, '=');
+    const config_field_t *field = value != NULL ? find_field(assignment, value - assignment) : NULL;
+    if (field == NULL)
+    {
+        ESP_LOGW(TAG, "Unknown setting in '%s'", assignment);
+        return ESP_ERR_NOT_FOUND;
+    }
+    value++;
+
+    uint8_t *dest = (uint8_t *)config + field->offset;
+    if (field->kind == FIELD_UINT16 || field->kind == FIELD_HOUR_MINS)
+    {
+        char *end;
+        long number = strtol(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || number < 0 || number > UINT16_MAX)
+        {
+            ESP_LOGW(TAG, "%s must be a number", field->key);
+            return ESP_ERR_INVALID_ARG;
+        }
+        *(uint16_t *)dest = number;
+    }
+    else if (strlen(value) < field->size)
+    {
+        strlcpy((char *)dest, value, field->size);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "%s is longer than %d characters", field->key, (int)field->size - 1);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (!field_valid(config, field))
+    {
+        ESP_LOGW(TAG, "%s is out of range", field->key);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+// Blobs from older versions are a prefix of the current layout, so they are laid over the defaults.  Anything
+// unreadable, newer or out of range falls back to the defaults entirely.
+static void load_stored(feeder_config_t *config)
+{
+    load_defaults(config);
+
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        ESP_LOGI(TAG, "No stored config, using defaults");
+        return;
+    }
+
+    feeder_config_t stored;
+    size_t size = 0;
+    esp_err_t err = nvs_get_blob(handle, CONFIG_KEY, NULL, &size);
+    if (err == ESP_OK && size >= sizeof(stored.version) && size <= sizeof(stored))
+    {
+        err = nvs_get_blob(handle, CONFIG_KEY, &stored, &size);
+    }
+    else if (err == ESP_OK)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Can't read stored config (%s), using defaults", esp_err_to_name(err));
+        return;
+    }
+
+    bool current = stored.version == FEEDER_CONFIG_VERSION && size == sizeof(stored);
+    bool older = stored.version < FEEDER_CONFIG_VERSION && size < sizeof(stored);
+    if (!current && !older)
+    {
+        ESP_LOGW(TAG, "Stored config v%lu (%d bytes) doesn't match v%d, using defaults", stored.version, (int)size, FEEDER_CONFIG_VERSION);
+        return;
+    }
+
+    feeder_config_t merged = *config;
+    memcpy(&merged, &stored, size);
+    merged.version = FEEDER_CONFIG_VERSION;
+    if (config_valid(&merged))
+    {
+        *config = merged;
+        ESP_LOGI(TAG, "Loaded config v%lu", stored.version);
+    }
+}
+
+static esp_err_t store(const feeder_config_t *config)
+{
+    nvs_handle_t handle;
+    esp_err_t err = init_nvs();
+    if (err == ESP_OK)
+    {
+        err = nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // NVS keeps the old blob until the new one is completely written, so a power cut leaves one or the other.
+    err = config != NULL ? nvs_set_blob(handle, CONFIG_KEY, config, sizeof(*config)) : nvs_erase_key(handle, CONFIG_KEY);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        err = ESP_OK;
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    return err;
+}
+
+// Call with the mutex held.
+static void publish(const feeder_config_t *config)
+{
+    active_config = config;
+    rtc_config.config = *config;
+    rtc_config.magic = RTC_CONFIG_MAGIC;
+}
+
+static void notify_change()
+{
+    for (int i = 0; i < change_cb_count; i++)
+    {
+        change_cbs[i]();
+    }
+}
+
+static feeder_config_t *spare_config()
+{
+    return active_config == &configs[0] ? &configs[1] : &configs[0];
+}
+
+esp_err_t feeder_config_init()
+{
+    config_mutex = xSemaphoreCreateMutexStatic(&config_mutex_buffer);
+
+    // Every write goes through publish(), so after a deep sleep the RTC copy matches NVS.  Any other reset reads
+    // NVS again.
+    esp_err_t err = ESP_OK;
+    if (esp_reset_reason() == ESP_RST_DEEPSLEEP && rtc_config.magic == RTC_CONFIG_MAGIC)
+    {
+        configs[0] = rtc_config.config;
+    }
+    else
+    {
+        err = init_nvs();
+        load_stored(&configs[0]);
+    }
+    publish(&configs[0]);
+    feeder_config_apply_timezone();
+
+    return err;
+}
+
+esp_err_t feeder_config_ensure_nvs()
+{
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    esp_err_t err = init_nvs();
+    xSemaphoreGive(config_mutex);
+
+    return err;
+}
+
+void feeder_config_apply_timezone()
+{
+    const char *timezone = feeder_config_get()->timezone;
+    const char *current = getenv("TZ");
+    if (current == NULL || strcmp(current, timezone) != 0)
+    {
+        setenv("TZ", timezone, 1);
+        tzset();
+    }
+}
+
+const feeder_config_t *feeder_config_get()
+{
+    return active_config;
+}
+
+esp_err_t feeder_config_update(int count, const char *const *assignments)
+{
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    feeder_config_t *config = spare_config();
+    *config = *active_config;
+
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < count && err == ESP_OK; i++)
+    {
+        err = apply_assignment(config, assignments[i]);
+    }
+    if (err == ESP_OK)
+    {
+        err = store(config);
+    }
+    if (err == ESP_OK)
+    {
+        publish(config);
+        ESP_LOGI(TAG, "Updated %d setting%s", count, count == 1 ? "" : "s");
+    }
+    xSemaphoreGive(config_mutex);
+
+    if (err == ESP_OK)
+    {
+        notify_change();
+    }
+
+    return err;
+}
+
+esp_err_t feeder_config_reset()
+{
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    esp_err_t err = store(NULL);
+    if (err == ESP_OK)
+    {
+        feeder_config_t *config = spare_config();
+        load_defaults(config);
+        publish(config);
+        ESP_LOGI(TAG, "Reset to defaults");
+    }
+    xSemaphoreGive(config_mutex);
+
+    if (err == ESP_OK)
+    {
+        notify_change();
+    }
+
+    return err;
+}
+
+esp_err_t feeder_config_register_change_cb(feeder_config_change_cb_t cb)
+{
+    if (change_cb_count == MAX_CHANGE_CBS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    change_cbs[change_cb_count++] = cb;
+
+    return ESP_OK;
+}
+
+static void print_config(const feeder_config_t *config)
+{
+    for (int i = 0; i < ARRAY_LEN(fields); i++)
+    {
+        const config_field_t *field = &fields[i];
+        const uint8_t *value = (const uint8_t *)config + field->offset;
+        switch (field->kind)
+        {
+        case FIELD_UINT16:
+            printf("%s=%u\n", field->key, *(const uint16_t *)value);
+            break;
+        case FIELD_HOUR_MINS:
+            printf("%s=%04u\n", field->key, *(const uint16_t *)value);
+            break;
+        case FIELD_STRING:
+            printf("%s=%s\n", field->key, (const char *)value);
+            break;
+        case FIELD_SECRET:
+            printf("%s=%s\n", field->key, *value != '\0' ? "********" : "");
+            break;
+        }
+    }
+}
+
+static int config_command(int argc, char **argv)
+{
+    esp_err_t err = ESP_OK;
+    if (argc == 2 && strcmp(argv[1], "reset") == 0)
+    {
+        err = feeder_config_reset();
+    }
+    else if (argc > 1)
+    {
+        err = feeder_config_update(argc - 1, (const char *const *)&argv[1]);
+    }
+
+    if (err != ESP_OK)
+    {
+        printf("Not changed: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    print_config(feeder_config_get());
+
+    return 0;
+}
+
+esp_err_t feeder_config_register_commands()
+{
+    const esp_console_cmd_t command = {
+        .command = "config",
+        .help = "Show the feeder settings, change them with key=value pairs (all or nothing), or 'reset' to the build defaults",
+        .hint = "[key=value ...|reset]",
+        .func = &config_command,
+    };
+
+    return esp_console_cmd_register(&command);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Bump when the layout changes.  Fields are only ever appended, so an older blob is a prefix of this one and
+// loads with the new fields at their defaults.
+#define FEEDER_CONFIG_VERSION 1
+
+// Settings that can change without reflashing.  Kept in NVS, loaded once at boot and read straight from RAM;
+// the Kconfig values are the defaults.  A copy in RTC memory lets a wake from deep sleep skip NVS.  Numbers come
+// first so the fields read on every step share a cache line.
+typedef struct {
+    uint32_t version;
+    uint16_t feeding_time;  // hhmm, local time
+    uint16_t steps_per_bucket;
+    uint16_t first_bucket_steps;
+    uint16_t bucket_count;
+    char timezone[64];  // POSIX TZ rule
+    char wifi_ssid[33];
+    char wifi_password[65];
+} feeder_config_t;
+
+typedef void (*feeder_config_change_cb_t)();
+
+// Call first thing at boot.  Sets up NVS for the whole firmware, then loads the stored settings and applies the
+// timezone.  A wake from deep sleep takes the settings from RTC memory and leaves NVS for
+// feeder_config_ensure_nvs().
+esp_err_t feeder_config_init();
+
+// Sets up NVS if this boot has not yet.  Call before anything else that uses NVS, such as the WiFi driver.
+esp_err_t feeder_config_ensure_nvs();
+
+// Applies the configured timezone if it has changed.  setenv() and tzset() race with localtime() on other tasks,
+// so updates leave this to the task doing the time keeping.
+void feeder_config_apply_timezone();
+
+// Never NULL.  Each update fills the spare copy and then swaps it in, so read the fields you need straight away
+// rather than keeping the pointer across a possible update.
+const feeder_config_t *feeder_config_get();
+
+// Applies "key=value" assignments all or nothing: if any key is unknown or value out of range, nothing changes.
+// Otherwise the new settings are written to NVS in one blob before they take effect.
+esp_err_t feeder_config_update(int count, const char *const *assignments);
+
+// Erases the stored settings and goes back to the Kconfig defaults.
+esp_err_t feeder_config_reset();
+
+// Called on the updating task after the new settings are in place, before the timezone is applied.
+esp_err_t feeder_config_register_change_cb(feeder_config_change_cb_t cb);
+
+// Adds the `config` console command.
+esp_err_t feeder_config_register_commands();
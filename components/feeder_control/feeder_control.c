@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "feeder_control.h"
+#include "feeder_motion.h"
+#include "feeder_hal.h"
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -12,129 +14,302 @@
 #include "driver/gpio.h"
 #include "freertos/queue.h"
 #include "esp_timer.h"
+#include "esp_pm.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "energy.h"
+#include "wifi_time.h"
+#include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "soc/soc_caps.h"
+#include "esp_console.h"
 
-#define STEP_COUNT 4
-#define STEP_DELAY_MS 5
+#define STEP_DELAY_MS (FEEDER_STEP_PERIOD_US / 1000)
+#define STEP_DELAY_TICKS (pdMS_TO_TICKS(STEP_DELAY_MS) > 0 ? pdMS_TO_TICKS(STEP_DELAY_MS) : 1)
+#define STEP_PERIOD_US ((int32_t)STEP_DELAY_TICKS * portTICK_PERIOD_MS * 1000)
 #define BTN_COOLDOWN_US 250000
+#define BUTTON_QUEUE_LEN 10
+#define BUTTON_TASK_STACK_SIZE 2048
+#define STEP_TASK_STACK_SIZE 2048
+// Changes with the state layout, so a position saved by an image with a different one is not restored.
+#define RTC_MOTION_MAGIC (0x46444d53 ^ ((uint32_t)FEEDER_MOTION_STATE_VERSION << 16) ^ (uint32_t)sizeof(feeder_motion_state_t))
+#define UA_US_PER_UAH 3.6e9
+#if CONFIG_TRACE_ENABLE
+// Step trace entries are timed in CPU cycles, which the decoder converts at the maximum frequency.  Also covers
+// the APB clock and light sleep.
+#define MOTOR_PM_LOCK ESP_PM_CPU_FREQ_MAX
+#elif defined(CONFIG_MOTOR_DRIVE_PWM)
+// LEDC runs off the APB clock, which frequency scaling would otherwise slow down mid move.
+#define MOTOR_PM_LOCK ESP_PM_APB_FREQ_MAX
+#else
+#define MOTOR_PM_LOCK ESP_PM_NO_LIGHT_SLEEP
+#endif
+#define ARRAY_LEN(array) (sizeof(array) / sizeof((array)[0]))
+#define STEP_HIST_BINS (ARRAY_LEN(STEP_HIST_EDGES_US) + 1)
 
-static uint64_t last_btn_1_down_us = 0;
-static uint64_t last_btn_2_down_us = 0;
+typedef struct {
+    uint32_t count;
+    int64_t dev_sum_us;
+    int64_t dev_sq_sum_us;
+    int32_t max_dev_us;
+} step_jitter_t;
+
+// Long enough ago that the press a deep sleep wake injects is not taken for a bounce.
+static int64_t last_btn_1_down_us = INT64_MIN / 2;
+static int64_t last_btn_2_down_us = INT64_MIN / 2;
 
 static QueueHandle_t button_queue;
+static StaticQueue_t button_queue_buffer;
+static uint8_t button_queue_storage[BUTTON_QUEUE_LEN * sizeof(int)];
+static StackType_t button_task_stack[BUTTON_TASK_STACK_SIZE];
+static StaticTask_t button_task_buffer;
+static StackType_t step_task_stack[STEP_TASK_STACK_SIZE];
+static StaticTask_t step_task_buffer;
+static TaskHandle_t step_task_handle;
+static esp_pm_lock_handle_t motor_pm_lock;
 
 static const char *TAG = "FEEDER_CONTROL";
-static const bool STEPS[STEP_COUNT][4] = {
-    {0, 0, 0, 1},
-    // {1, 0, 0, 1},
-    {0, 0, 1, 0},
-    // {0, 0, 1, 1},
-    {0, 1, 0, 0},
-    // {0, 1, 1, 0},
-    {1, 0, 0, 0},
-    // {1, 1, 0, 0},
-};
+// Bin edges of the step interval histogram, as deviation from the nominal period.  Below the first edge and from
+// the last one on get a bin each.
+static const int32_t STEP_HIST_EDGES_US[] = {-1000, -250, -50, 50, 250, 1000, 5000};
+
+static bool motor_running = false;
+static int64_t last_step_us = 0;
+static int64_t move_start_us;
+static uint64_t move_start_drive_us;
+// Long enough ago that a timer wake counts as idle straight away.
+static int64_t last_button_us = INT64_MIN / 2;
+
+// No-init so the position also survives the software restart into a new firmware image.  The magic is only
+// trusted after a deep sleep or software reset.
+static RTC_NOINIT_ATTR uint32_t rtc_motion_magic;
+static RTC_NOINIT_ATTR feeder_motion_state_t rtc_motion_state;
+// Step period deviation, split by whether a WiFi time sync was running concurrently.
+// Indexed by whether a time sync was running.  Since boot, and for the current or last move.
+static step_jitter_t step_jitter[2];
+static step_jitter_t move_jitter[2];
+// Read from the console and scheduler tasks while the step task updates them.
+static portMUX_TYPE jitter_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t step_histogram[STEP_HIST_BINS];
+
+static void start_motor()
+{
+    if (!motor_running)
+    {
+        esp_pm_lock_acquire(motor_pm_lock);
+        energy_begin(ENERGY_STATE_MOTOR);
+        motor_running = true;
+        taskENTER_CRITICAL(&jitter_lock);
+        memset(move_jitter, 0, sizeof(move_jitter));
+        taskEXIT_CRITICAL(&jitter_lock);
+        move_start_us = esp_timer_get_time();
+        move_start_drive_us = energy_state_us(ENERGY_STATE_MOTOR);
+    }
+}
+
+static void wake_step_task()
+{
+    if (step_task_handle != NULL)
+    {
+        xTaskNotifyGive(step_task_handle);
+    }
+}
+
+static void add_jitter_sample(step_jitter_t *jitter, int32_t dev_us)
+{
+    jitter->count++;
+    jitter->dev_sum_us += dev_us;
+    jitter->dev_sq_sum_us += (int64_t)dev_us * dev_us;
+    if (abs(dev_us) > jitter->max_dev_us)
+    {
+        jitter->max_dev_us = abs(dev_us);
+    }
+}
+
+static void record_step_time()
+{
+    int64_t now_us = esp_timer_get_time();
+    if (last_step_us != 0)
+    {
+        int radio = wifi_time_is_active() ? 1 : 0;
+        int32_t dev_us = (now_us - last_step_us) - STEP_PERIOD_US;
+        taskENTER_CRITICAL(&jitter_lock);
+        add_jitter_sample(&step_jitter[radio], dev_us);
+        add_jitter_sample(&move_jitter[radio], dev_us);
+        taskEXIT_CRITICAL(&jitter_lock);
+
+        int bin = 0;
+        while (bin < ARRAY_LEN(STEP_HIST_EDGES_US) && dev_us >= STEP_HIST_EDGES_US[bin])
+        {
+            bin++;
+        }
+        step_histogram[bin]++;
+    }
+    last_step_us = now_us;
+}
+
+static void log_step_jitter(const char *label, const step_jitter_t *jitter)
+{
+    if (jitter->count == 0)
+    {
+        return;
+    }
 
-static int step_idx = 0;
-static int position = 0;
-static int target_pos = 0;
-static bool callibrating = false;
-static bool has_callibrated = false;
+    int64_t mean_us = jitter->dev_sum_us / jitter->count;
+    int64_t variance_us2 = jitter->dev_sq_sum_us / jitter->count - mean_us * mean_us;
+    ESP_LOGI(TAG, "Step jitter %s: n=%lu mean=%lldus var=%lldus^2 max=%ldus", label, jitter->count, mean_us, variance_us2, jitter->max_dev_us);
+}
 
-static void update_stepper_out()
+static void log_jitter_pair(const step_jitter_t *source, const char *idle_label, const char *sync_label)
 {
-    gpio_set_level(CONFIG_STEP1_GPIO, STEPS[step_idx][0]);
-    gpio_set_level(CONFIG_STEP2_GPIO, STEPS[step_idx][1]);
-    gpio_set_level(CONFIG_STEP3_GPIO, STEPS[step_idx][2]);
-    gpio_set_level(CONFIG_STEP4_GPIO, STEPS[step_idx][3]);
+    step_jitter_t jitter[2];
+    taskENTER_CRITICAL(&jitter_lock);
+    memcpy(jitter, source, sizeof(jitter));
+    taskEXIT_CRITICAL(&jitter_lock);
+
+    log_step_jitter(idle_label, &jitter[0]);
+    log_step_jitter(sync_label, &jitter[1]);
 }
 
-static void step_forward()
+void feeder_control_log_jitter()
 {
-    step_idx = (step_idx + 1) % STEP_COUNT;
-    update_stepper_out();
-    position++;
+    log_jitter_pair(move_jitter, "last move, idle radio", "last move, during sync");
 }
 
-static void step_backwards()
+// Coil on time against the same time at full drive, which is what the charge estimate is based on.
+static void log_move_energy()
 {
-    step_idx = (step_idx - 1 + STEP_COUNT) % STEP_COUNT;
-    update_stepper_out();
-    position--;
+    int64_t coil_us = esp_timer_get_time() - move_start_us;
+    uint64_t drive_us = energy_state_us(ENERGY_STATE_MOTOR) - move_start_drive_us;
+    ESP_LOGI(TAG, "Move: coils on %lld ms, %llu ms at full drive, ~%.1f uAh", coil_us / 1000, drive_us / 1000,
+             drive_us * (double)CONFIG_ENERGY_MOTOR_UA / UA_US_PER_UAH);
 }
 
 static void stop()
 {
-    gpio_set_level(CONFIG_STEP1_GPIO, 0);
-    gpio_set_level(CONFIG_STEP2_GPIO, 0);
-    gpio_set_level(CONFIG_STEP3_GPIO, 0);
-    gpio_set_level(CONFIG_STEP4_GPIO, 0);
+    feeder_hal_set_coils(0);
+
+    if (motor_running)
+    {
+        motor_running = false;
+        energy_end(ENERGY_STATE_MOTOR);
+        esp_pm_lock_release(motor_pm_lock);
+        last_step_us = 0;
+        log_move_energy();
+    }
+}
+
+// Keeps the last phase energized at a low duty for a while after a move, so the bucket does not slip back.
+// Returns true if another move was queued meanwhile, in which case it carries on without dropping the coils.
+static bool hold_position()
+{
+#if defined(CONFIG_MOTOR_DRIVE_PWM) && CONFIG_MOTOR_PWM_HOLD_MS > 0
+    if (motor_running)
+    {
+        // The gap before any next move is not a step period.
+        last_step_us = 0;
+        feeder_hal_set_duty(CONFIG_MOTOR_PWM_HOLD_DUTY * 10);
+        energy_set_level(ENERGY_STATE_MOTOR, CONFIG_MOTOR_PWM_HOLD_DUTY * 10);
+        return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_MOTOR_PWM_HOLD_MS)) != 0;
+    }
+#endif
+
+    return false;
 }
 
 static void IRAM_ATTR gpio_interrupt_handler(void *args)
 {
     int pinNumber = (int)args;
+    // Level triggered, so quiet the pin until the task has read it and armed the opposite level.
+    gpio_intr_disable(pinNumber);
+    trace_record_timed(TRACE_EVT_BUTTON_ISR, pinNumber);
     xQueueSendFromISR(button_queue, &pinNumber, NULL);
 }
 
 void start_callibration()
 {
-    callibrating = true;
-    ESP_LOGI(TAG, "Started callibration");
-    has_callibrated = true;
-}
-
-static bool all_buckets_extended()
-{
-    return target_pos >= CONFIG_BUCKET_COUNT * CONFIG_STEPS_PER_BUCKET;
+    feeder_motion_start_callibration();
+    telemetry_record(TELEMETRY_EVT_CALIBRATE, 0);
+    wake_step_task();
 }
 
 void extend_bucket()
 {
-    if (!all_buckets_extended() && target_pos <= position)
+    if (feeder_motion_extend_bucket())
     {
-        target_pos += (target_pos == 0 ? CONFIG_FIRST_BUCKET_STEPS : CONFIG_STEPS_PER_BUCKET);
-        ESP_LOGI(TAG, "Next bucket: %d", target_pos);
+        telemetry_record(TELEMETRY_EVT_FEED, feeder_motion_target());
+        wake_step_task();
     }
 }
 
 void eject_buckets()
 {
-    has_callibrated = false;
-    if (target_pos <= position)
+    if (feeder_motion_eject_buckets())
     {
-        target_pos += CONFIG_STEPS_PER_BUCKET * 3;
-        ESP_LOGI(TAG, "Ejecting buckets: %d", target_pos);
+        wake_step_task();
     }
 }
 
+// Light sleep only wakes on GPIO levels, and the wake level is also the pin's interrupt type.  Each input is armed
+// on the level opposite to the one just read, which stands in for an any edge interrupt and wakes the chip on a
+// press or release.  Reading first means a change in between fires straight away rather than being missed.
+static int arm_input(int pin)
+{
+    int level = gpio_get_level(pin);
+    gpio_wakeup_enable(pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    gpio_intr_enable(pin);
+
+    return level;
+}
+
+static void install_button_isrs()
+{
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_EXTEND_BTN_GPIO, gpio_interrupt_handler, (void *)CONFIG_EXTEND_BTN_GPIO));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_RETRACT_BTN_GPIO, gpio_interrupt_handler, (void *)CONFIG_RETRACT_BTN_GPIO));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_LIMIT_GPIO, gpio_interrupt_handler, (void *)CONFIG_LIMIT_GPIO));
+    arm_input(CONFIG_EXTEND_BTN_GPIO);
+    arm_input(CONFIG_RETRACT_BTN_GPIO);
+    arm_input(CONFIG_LIMIT_GPIO);
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+}
+
 static void button_queue_task(void *params)
 {
     int pinNumber;
     int level;
+
+    // The ISR service binds to the core it is installed from, keeping button interrupts with this task.
+    install_button_isrs();
+
     while (true)
     {
         if (xQueueReceive(button_queue, &pinNumber, portMAX_DELAY))
         {
+            // The limit acts when it closes, the buttons when they are released, as the edge interrupts did.
+            level = arm_input(pinNumber);
             if (pinNumber == CONFIG_LIMIT_GPIO)
             {
-                level = gpio_get_level(pinNumber);
-                if (callibrating && level == 0)
+                if (level == 0)
                 {
-                    ESP_LOGI(TAG, "Callibration end");
-                    position = 0;
-                    target_pos = 0;
-                    callibrating = false;
+                    feeder_motion_limit_reached();
                 }
             }
+            else if (level == 0)
+            {
+                continue;
+            }
             else if ( pinNumber == CONFIG_EXTEND_BTN_GPIO)
             {
-                uint64_t now_us = esp_timer_get_time();
+                int64_t now_us = esp_timer_get_time();
+                last_button_us = now_us;
                 bool on_cooldown = now_us - last_btn_1_down_us < BTN_COOLDOWN_US;
                 last_btn_1_down_us = now_us;
 
                 if(!on_cooldown) {
                     ESP_LOGI(TAG, "BTN 1");
-                    if (all_buckets_extended())
+                    telemetry_record(TELEMETRY_EVT_BUTTON, pinNumber);
+                    if (feeder_motion_all_buckets_extended())
                     {
                         eject_buckets();
                     }
@@ -144,13 +319,15 @@ static void button_queue_task(void *params)
                     }
                 }
             }
-            else if (!has_callibrated && pinNumber == CONFIG_RETRACT_BTN_GPIO)
+            else if (!feeder_motion_has_callibrated() && pinNumber == CONFIG_RETRACT_BTN_GPIO)
             {
-                uint64_t now_us = esp_timer_get_time();
+                int64_t now_us = esp_timer_get_time();
+                last_button_us = now_us;
                 bool on_cooldown = now_us - last_btn_2_down_us < BTN_COOLDOWN_US;
                 last_btn_2_down_us = now_us;
                 if(!on_cooldown) {
                     ESP_LOGI(TAG, "BTN 2");
+                    telemetry_record(TELEMETRY_EVT_BUTTON, pinNumber);
                     level = gpio_get_level(CONFIG_LIMIT_GPIO);
                     if (level == 1)
                     {
@@ -166,22 +343,37 @@ static void button_queue_task(void *params)
 
 static void target_step_task(void *params)
 {
+    TickType_t last_step_tick = xTaskGetTickCount();
     while (true)
     {
-        if (callibrating || target_pos < position)
-        {
-            step_backwards();
-        }
-        else if (target_pos > position)
+        if (feeder_motion_step())
         {
-            step_forward();
+            // The first step of a move usually follows a long idle, so it carries the time.
+            if (motor_running)
+            {
+                trace_record(TRACE_EVT_STEP, feeder_motion_position());
+            }
+            else
+            {
+                trace_record_timed(TRACE_EVT_STEP, feeder_motion_position());
+            }
+            start_motor();
+            energy_set_level(ENERGY_STATE_MOTOR, feeder_motion_duty());
+            record_step_time();
         }
         else
         {
-            stop();
+            // Block while idle so the chip can light sleep; moves notify this task.
+            if (!hold_position())
+            {
+                stop();
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            last_step_tick = xTaskGetTickCount();
+            continue;
         }
 
-        vTaskDelay(STEP_DELAY_MS / portTICK_PERIOD_MS);
+        vTaskDelayUntil(&last_step_tick, STEP_DELAY_TICKS);
     }
 
     vTaskDelete(NULL);
@@ -189,8 +381,17 @@ static void target_step_task(void *params)
 
 static esp_err_t init_button_control()
 {
+#if SOC_PM_SUPPORT_EXT0_WAKEUP
+    if (rtc_gpio_is_valid_gpio(CONFIG_EXTEND_BTN_GPIO))
+    {
+        // Hand the pin back from the RTC mux a deep sleep wake left it on.
+        rtc_gpio_deinit(CONFIG_EXTEND_BTN_GPIO);
+    }
+#endif
+
     gpio_config_t in_conf = {};
-    in_conf.intr_type = GPIO_INTR_POSEDGE;
+    // Armed once the ISRs are in place.
+    in_conf.intr_type = GPIO_INTR_DISABLE;
     in_conf.mode = GPIO_MODE_INPUT;
     in_conf.pin_bit_mask = (1ULL << CONFIG_EXTEND_BTN_GPIO | 1ULL << CONFIG_RETRACT_BTN_GPIO | 1ULL << CONFIG_LIMIT_GPIO);
     in_conf.pull_down_en = 0;
@@ -202,29 +403,37 @@ static esp_err_t init_button_control()
         return config_err;
     }
 
-    config_err |= gpio_set_intr_type(CONFIG_LIMIT_GPIO, GPIO_INTR_NEGEDGE);
+    button_queue = xQueueCreateStatic(BUTTON_QUEUE_LEN, sizeof(int), button_queue_storage, &button_queue_buffer);
+    xTaskCreateStaticPinnedToCore(button_queue_task, "Button queue task", BUTTON_TASK_STACK_SIZE, NULL, CONFIG_INPUT_TASK_PRIORITY,
+                                  button_task_stack, &button_task_buffer, CONFIG_MOTOR_TASK_CORE);
+    step_task_handle = xTaskCreateStaticPinnedToCore(target_step_task, "Target step task", STEP_TASK_STACK_SIZE, NULL, CONFIG_MOTOR_TASK_PRIORITY,
+                                                     step_task_stack, &step_task_buffer, CONFIG_MOTOR_TASK_CORE);
 
-    button_queue = xQueueCreate(10, sizeof(int));
-    xTaskCreate(button_queue_task, "Button queue task", 2048, NULL, 5, NULL);
-    xTaskCreate(target_step_task, "Target step task", 2048, NULL, 5, NULL);
-
-    ESP_ERROR_CHECK(gpio_install_isr_service(0));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_EXTEND_BTN_GPIO, gpio_interrupt_handler, (void *)CONFIG_EXTEND_BTN_GPIO));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_RETRACT_BTN_GPIO, gpio_interrupt_handler, (void *)CONFIG_RETRACT_BTN_GPIO));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_LIMIT_GPIO, gpio_interrupt_handler, (void *)CONFIG_LIMIT_GPIO));
+    // The press that woke the chip happened before the ISRs existed.
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0)
+    {
+        int pin = CONFIG_EXTEND_BTN_GPIO;
+        xQueueSend(button_queue, &pin, 0);
+    }
 
     return config_err;
 }
 
 static esp_err_t init_motor_control()
 {
-    gpio_config_t out_conf = {};
-    out_conf.intr_type = GPIO_INTR_DISABLE;
-    out_conf.mode = GPIO_MODE_OUTPUT;
-    out_conf.pin_bit_mask = (1LL << CONFIG_STEP1_GPIO | 1LL << CONFIG_STEP2_GPIO | 1LL << CONFIG_STEP3_GPIO | 1LL << CONFIG_STEP4_GPIO);
-    out_conf.pull_down_en = 0;
-    out_conf.pull_up_en = 0;
-    esp_err_t config_err = gpio_config(&out_conf);
+    esp_err_t config_err = feeder_hal_init();
+    feeder_hal_hold(false);
+
+    esp_reset_reason_t reason = esp_reset_reason();
+    if ((reason == ESP_RST_DEEPSLEEP || reason == ESP_RST_SW) && rtc_motion_magic == RTC_MOTION_MAGIC)
+    {
+        feeder_motion_restore(&rtc_motion_state);
+        ESP_LOGI(TAG, "Restored position %d after %s", feeder_motion_position(), reason == ESP_RST_DEEPSLEEP ? "deep sleep" : "restart");
+    }
+    rtc_motion_magic = 0;
+
+    // Coils drop out in light sleep, so hold it off while a move is in progress.
+    esp_pm_lock_create(MOTOR_PM_LOCK, 0, "motor", &motor_pm_lock);
 
     return config_err;
 }
@@ -234,3 +443,90 @@ void feeder_control_init()
     ESP_ERROR_CHECK(init_motor_control());
     ESP_ERROR_CHECK(init_button_control());
 }
+
+bool feeder_control_idle_for(int64_t idle_us)
+{
+    return !motor_running && !feeder_motion_is_callibrating() && feeder_motion_target() == feeder_motion_position() &&
+           uxQueueMessagesWaiting(button_queue) == 0 && esp_timer_get_time() - last_button_us >= idle_us;
+}
+
+void feeder_control_prepare_restart()
+{
+    feeder_motion_save(&rtc_motion_state);
+    rtc_motion_magic = RTC_MOTION_MAGIC;
+    feeder_hal_set_coils(0);
+}
+
+bool feeder_control_prepare_deep_sleep()
+{
+    if (!feeder_motion_has_callibrated())
+    {
+        return false;
+    }
+
+    feeder_motion_save(&rtc_motion_state);
+    rtc_motion_magic = RTC_MOTION_MAGIC;
+
+    feeder_hal_set_coils(0);
+    feeder_hal_hold(true);
+    // GPIO wakeup is for light sleep only; the extend button wakes a deep sleep through ext0 below.
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+
+#if SOC_PM_SUPPORT_EXT0_WAKEUP
+    if (rtc_gpio_is_valid_gpio(CONFIG_EXTEND_BTN_GPIO))
+    {
+        // The digital pull-up is off in deep sleep, so keep the button high from the RTC domain.
+        rtc_gpio_pullup_en(CONFIG_EXTEND_BTN_GPIO);
+        rtc_gpio_pulldown_dis(CONFIG_EXTEND_BTN_GPIO);
+        esp_sleep_enable_ext0_wakeup(CONFIG_EXTEND_BTN_GPIO, 0);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Extend button is not an RTC GPIO, it will not wake the feeder");
+    }
+#endif
+
+    return true;
+}
+
+static int steps_command(int argc, char **argv)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < STEP_HIST_BINS; i++)
+    {
+        total += step_histogram[i];
+    }
+
+    printf("Step intervals, nominal %ld us\n", STEP_PERIOD_US);
+    for (int i = 0; i < STEP_HIST_BINS; i++)
+    {
+        if (i == 0)
+        {
+            printf("%13s < %6ld us", "", STEP_PERIOD_US + STEP_HIST_EDGES_US[0]);
+        }
+        else if (i == STEP_HIST_BINS - 1)
+        {
+            printf("%13s >= %5ld us", "", STEP_PERIOD_US + STEP_HIST_EDGES_US[i - 1]);
+        }
+        else
+        {
+            printf("%6ld .. %6ld us", STEP_PERIOD_US + STEP_HIST_EDGES_US[i - 1], STEP_PERIOD_US + STEP_HIST_EDGES_US[i]);
+        }
+        printf(" %8lu %3lu%%\n", step_histogram[i], total != 0 ? step_histogram[i] * 100 / total : 0);
+    }
+    log_jitter_pair(step_jitter, "since boot, idle radio", "since boot, during sync");
+    feeder_control_log_jitter();
+
+    return 0;
+}
+
+esp_err_t feeder_control_register_commands()
+{
+    const esp_console_cmd_t command = {
+        .command = "steps",
+        .help = "Histogram of actual step intervals since boot, and the step jitter since boot and for the last move, with and without a time sync running",
+        .func = &steps_command,
+    };
+
+    return esp_console_cmd_register(&command);
+}
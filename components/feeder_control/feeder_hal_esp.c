@@ -0,0 +1,119 @@
+#include "feeder_hal.h"
+#include "sdkconfig.h"
+#include "driver/gpio.h"
+#ifdef CONFIG_MOTOR_DRIVE_PWM
+#include "driver/ledc.h"
+
+#define PWM_MODE LEDC_LOW_SPEED_MODE
+#define PWM_TIMER LEDC_TIMER_0
+#define PWM_RESOLUTION_BITS 10
+#define PWM_DUTY_MAX (1 << PWM_RESOLUTION_BITS)
+#endif
+
+static const gpio_num_t pins[] = {CONFIG_STEP1_GPIO, CONFIG_STEP2_GPIO, CONFIG_STEP3_GPIO, CONFIG_STEP4_GPIO};
+
+#ifdef CONFIG_MOTOR_DRIVE_PWM
+static uint8_t coils = 0;
+static uint16_t duty_permille = FEEDER_DUTY_FULL;
+
+// Channel n drives the pin of FEEDER_COIL_<n+1>.
+static void update_channels()
+{
+    uint32_t duty = (uint32_t)duty_permille * PWM_DUTY_MAX / FEEDER_DUTY_FULL;
+    for (int i = 0; i < sizeof(pins) / sizeof(pins[0]); i++)
+    {
+        ledc_set_duty(PWM_MODE, LEDC_CHANNEL_0 + i, (coils & (1 << i)) ? duty : 0);
+        ledc_update_duty(PWM_MODE, LEDC_CHANNEL_0 + i);
+    }
+}
+
+esp_err_t feeder_hal_init()
+{
+    ledc_timer_config_t timer_conf = {
+        .speed_mode = PWM_MODE,
+        .duty_resolution = PWM_RESOLUTION_BITS,
+        .timer_num = PWM_TIMER,
+        .freq_hz = CONFIG_MOTOR_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    esp_err_t err = ledc_timer_config(&timer_conf);
+
+    for (int i = 0; i < sizeof(pins) / sizeof(pins[0]) && err == ESP_OK; i++)
+    {
+        ledc_channel_config_t channel_conf = {
+            .gpio_num = pins[i],
+            .speed_mode = PWM_MODE,
+            .channel = LEDC_CHANNEL_0 + i,
+            .timer_sel = PWM_TIMER,
+            .duty = 0,
+            .hpoint = 0,
+        };
+        err = ledc_channel_config(&channel_conf);
+    }
+
+    return err;
+}
+
+void feeder_hal_set_coils(uint8_t coil_mask)
+{
+    coils = coil_mask;
+    update_channels();
+}
+
+void feeder_hal_set_duty(uint16_t duty)
+{
+    if (duty != duty_permille)
+    {
+        duty_permille = duty;
+        update_channels();
+    }
+}
+#else
+esp_err_t feeder_hal_init()
+{
+    gpio_config_t out_conf = {};
+    out_conf.intr_type = GPIO_INTR_DISABLE;
+    out_conf.mode = GPIO_MODE_OUTPUT;
+    out_conf.pin_bit_mask = (1LL << CONFIG_STEP1_GPIO | 1LL << CONFIG_STEP2_GPIO | 1LL << CONFIG_STEP3_GPIO | 1LL << CONFIG_STEP4_GPIO);
+    out_conf.pull_down_en = 0;
+    out_conf.pull_up_en = 0;
+
+    return gpio_config(&out_conf);
+}
+
+void feeder_hal_set_coils(uint8_t coil_mask)
+{
+    gpio_set_level(CONFIG_STEP1_GPIO, (coil_mask & FEEDER_COIL_1) != 0);
+    gpio_set_level(CONFIG_STEP2_GPIO, (coil_mask & FEEDER_COIL_2) != 0);
+    gpio_set_level(CONFIG_STEP3_GPIO, (coil_mask & FEEDER_COIL_3) != 0);
+    gpio_set_level(CONFIG_STEP4_GPIO, (coil_mask & FEEDER_COIL_4) != 0);
+}
+
+void feeder_hal_set_duty(uint16_t duty_permille)
+{
+}
+#endif
+
+void feeder_hal_hold(bool hold)
+{
+    for (int i = 0; i < sizeof(pins) / sizeof(pins[0]); i++)
+    {
+        if (hold)
+        {
+            gpio_hold_en(pins[i]);
+        }
+        else
+        {
+            gpio_hold_dis(pins[i]);
+        }
+    }
+
+    if (hold)
+    {
+        gpio_deep_sleep_hold_en();
+    }
+    else
+    {
+        gpio_deep_sleep_hold_dis();
+    }
+}
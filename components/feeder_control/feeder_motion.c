@@ -0,0 +1,150 @@
+#include "feeder_motion.h"
+#include "feeder_hal.h"
+#include "feeder_config.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+static const char *TAG = "FEEDER_MOTION";
+
+static int step_idx = 0;
+static int position = 0;
+static int target_pos = 0;
+static bool callibrating = false;
+static bool has_callibrated = false;
+static int move_steps = 0;
+static uint16_t move_duty = FEEDER_DUTY_FULL;
+
+// Full duty while the rotor and bucket get going from rest, less once they are moving.
+static uint16_t profile_duty(int move_step)
+{
+#ifdef CONFIG_MOTOR_DRIVE_PWM
+    return move_step < CONFIG_MOTOR_PWM_ACCEL_STEPS ? FEEDER_DUTY_FULL : CONFIG_MOTOR_PWM_CRUISE_DUTY * 10;
+#else
+    return FEEDER_DUTY_FULL;
+#endif
+}
+
+void feeder_motion_start_callibration()
+{
+    callibrating = true;
+    ESP_LOGI(TAG, "Started callibration");
+    has_callibrated = true;
+}
+
+bool feeder_motion_limit_reached()
+{
+    if (!callibrating)
+    {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Callibration end");
+    position = 0;
+    target_pos = 0;
+    callibrating = false;
+
+    return true;
+}
+
+bool feeder_motion_all_buckets_extended()
+{
+    const feeder_config_t *config = feeder_config_get();
+
+    return feeder_all_buckets_extended(target_pos, config->bucket_count, config->steps_per_bucket);
+}
+
+bool feeder_motion_extend_bucket()
+{
+    if (!feeder_motion_all_buckets_extended() && target_pos <= position)
+    {
+        const feeder_config_t *config = feeder_config_get();
+        target_pos = feeder_next_bucket_target(target_pos, config->first_bucket_steps, config->steps_per_bucket);
+        ESP_LOGI(TAG, "Next bucket: %d", target_pos);
+        return true;
+    }
+
+    return false;
+}
+
+bool feeder_motion_eject_buckets()
+{
+    has_callibrated = false;
+    if (target_pos <= position)
+    {
+        target_pos = feeder_eject_target(target_pos, feeder_config_get()->steps_per_bucket);
+        ESP_LOGI(TAG, "Ejecting buckets: %d", target_pos);
+        return true;
+    }
+
+    return false;
+}
+
+bool feeder_motion_step()
+{
+    if (callibrating || target_pos < position)
+    {
+        step_idx = feeder_next_phase(step_idx, -1);
+        position--;
+    }
+    else if (target_pos > position)
+    {
+        step_idx = feeder_next_phase(step_idx, 1);
+        position++;
+    }
+    else
+    {
+        move_steps = 0;
+        return false;
+    }
+
+    move_duty = profile_duty(move_steps++);
+    feeder_hal_set_duty(move_duty);
+    feeder_hal_set_coils(FEEDER_PHASES[FEEDER_DRIVE_WAVE][step_idx]);
+
+    return true;
+}
+
+uint16_t feeder_motion_duty()
+{
+    return move_duty;
+}
+
+bool feeder_motion_has_callibrated()
+{
+    return has_callibrated;
+}
+
+bool feeder_motion_is_callibrating()
+{
+    return callibrating;
+}
+
+int feeder_motion_position()
+{
+    return position;
+}
+
+int feeder_motion_target()
+{
+    return target_pos;
+}
+
+void feeder_motion_save(feeder_motion_state_t *state)
+{
+    *state = (feeder_motion_state_t){
+        .step_idx = step_idx,
+        .position = position,
+        .target = target_pos,
+        .callibrating = callibrating,
+        .has_callibrated = has_callibrated,
+    };
+}
+
+void feeder_motion_restore(const feeder_motion_state_t *state)
+{
+    step_idx = state->step_idx;
+    position = state->position;
+    target_pos = state->target;
+    callibrating = state->callibrating;
+    has_callibrated = state->has_callibrated;
+}
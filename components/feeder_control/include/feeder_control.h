@@ -1,9 +1,34 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_system.h"
+#include "esp_err.h"
 
 void start_callibration();
 
 void extend_bucket();
 
+void eject_buckets();
+
+// On a wake from deep sleep, restores the position saved by feeder_control_prepare_deep_sleep() and treats an
+// extend button wake as a press.
 void feeder_control_init();
+
+// True when no move is running or queued and no button has been pressed for idle_us.
+bool feeder_control_idle_for(int64_t idle_us);
+
+// Saves the position to RTC memory, holds the coils off and arms the extend button as a wake source.  Returns
+// false, changing nothing, if the feeder has not been callibrated, since there is no position worth keeping.
+bool feeder_control_prepare_deep_sleep();
+
+// Saves the position to RTC memory and drops the coils, for an esp_restart() that should carry on where it left
+// off.  Call only while idle.
+void feeder_control_prepare_restart();
+
+// Log the last move's step period deviation from nominal, with and without a concurrent time sync.  Called from
+// the scheduler, so the logging stays off the motor core.
+void feeder_control_log_jitter();
+
+// Adds the `steps` console command.
+esp_err_t feeder_control_register_commands();
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "feeder_core.h"
+
+// Hardware seam for the stepper outputs.  feeder_hal_esp.c drives the GPIOs, or LEDC PWM channels on the same
+// pins with CONFIG_MOTOR_DRIVE_PWM, host/mock_hal.c records them.
+
+// Coil masks are the FEEDER_COIL_* bits from feeder_core.h.
+
+#define FEEDER_DUTY_FULL 1000
+
+esp_err_t feeder_hal_init();
+
+void feeder_hal_set_coils(uint8_t coil_mask);
+
+// Share of each PWM period the energized coils are driven, in permille, from now on.  Plain GPIO drive is always
+// at full duty and ignores it.
+void feeder_hal_set_duty(uint16_t duty_permille);
+
+// Latches the coil outputs at their current level, including through deep sleep, until released.
+void feeder_hal_hold(bool hold);
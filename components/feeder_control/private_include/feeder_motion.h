@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "feeder_core.h"
+
+// Bucket positioning and step sequencing, free of RTOS and driver calls so it also builds for the host.  The
+// sequence and geometry arithmetic come from feeder_core.h, shared with the Arduino sketch.
+
+// Bump when a field changes meaning without changing the size of the struct.
+#define FEEDER_MOTION_STATE_VERSION 1
+
+// Kept in RTC memory across deep sleep and the restart into a new image, see feeder_control.c.
+typedef struct {
+    int step_idx;
+    int position;
+    int target;
+    bool callibrating;
+    bool has_callibrated;
+} feeder_motion_state_t;
+
+void feeder_motion_start_callibration();
+
+// Returns true when the limit switch ended a callibration and the position was zeroed.
+bool feeder_motion_limit_reached();
+
+// The queue functions return true when a new target was set.
+bool feeder_motion_extend_bucket();
+
+bool feeder_motion_eject_buckets();
+
+// Take one step towards the target, at the duty the drive profile gives that step of the move.  Returns false,
+// without touching the coils, once there.
+bool feeder_motion_step();
+
+// Coil duty of the latest step, in permille.
+uint16_t feeder_motion_duty();
+
+bool feeder_motion_all_buckets_extended();
+
+bool feeder_motion_has_callibrated();
+
+bool feeder_motion_is_callibrating();
+
+int feeder_motion_position();
+
+int feeder_motion_target();
+
+// For carrying the position through a deep sleep.
+void feeder_motion_save(feeder_motion_state_t *state);
+
+void feeder_motion_restore(const feeder_motion_state_t *state);
@@ -0,0 +1,117 @@
+#pragma once
+
+// Header only feeder core shared by the ESP-IDF firmware and the Arduino sketch (symlinked into
+// Arduino/simple-fish-feeder/src): coil sequencing, bucket geometry and feeding schedule arithmetic.  The plain
+// inline functions build as C or C++; the Stepper template below is C++ only.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bit n of a coil mask energizes the coil on STEP<n+1>_GPIO.
+#define FEEDER_COIL_1 (1 << 0)
+#define FEEDER_COIL_2 (1 << 1)
+#define FEEDER_COIL_3 (1 << 2)
+#define FEEDER_COIL_4 (1 << 3)
+
+#define FEEDER_PHASE_COUNT 4
+#define FEEDER_STEP_PERIOD_US 5000
+
+// Defaults for the printables.com bucket carousel, matching main/Kconfig.projbuild.
+#define FEEDER_BUCKET_COUNT 10
+#define FEEDER_FIRST_BUCKET_STEPS 420
+#define FEEDER_STEPS_PER_BUCKET 340
+// Buckets' worth of travel past the last one that pushes them all out.
+#define FEEDER_EJECT_BUCKETS 3
+
+#define FEEDER_MINS_PER_DAY (24 * 60)
+
+typedef enum {
+    FEEDER_DRIVE_WAVE = 0,  // one coil at a time, least current
+    FEEDER_DRIVE_FULL_STEP, // two neighbouring coils, more torque for the same step angle
+    FEEDER_DRIVE_MODE_COUNT,
+} feeder_drive_mode_t;
+
+// Coil masks in stepping order, forward being the extend direction.
+static const uint8_t FEEDER_PHASES[FEEDER_DRIVE_MODE_COUNT][FEEDER_PHASE_COUNT] = {
+    {FEEDER_COIL_4, FEEDER_COIL_3, FEEDER_COIL_2, FEEDER_COIL_1},
+    {FEEDER_COIL_4 | FEEDER_COIL_3, FEEDER_COIL_3 | FEEDER_COIL_2, FEEDER_COIL_2 | FEEDER_COIL_1, FEEDER_COIL_1 | FEEDER_COIL_4},
+};
+
+// Phase index after one step forward (direction > 0) or back.
+static inline int feeder_next_phase(int phase, int direction)
+{
+    return (phase + (direction > 0 ? 1 : FEEDER_PHASE_COUNT - 1)) % FEEDER_PHASE_COUNT;
+}
+
+// Target position once one more bucket is out, from target (0 being all in).  The first bucket sits further out.
+static inline int feeder_next_bucket_target(int target, int first_bucket_steps, int steps_per_bucket)
+{
+    return target + (target == 0 ? first_bucket_steps : steps_per_bucket);
+}
+
+static inline bool feeder_all_buckets_extended(int target, int bucket_count, int steps_per_bucket)
+{
+    return target >= bucket_count * steps_per_bucket;
+}
+
+static inline int feeder_eject_target(int target, int steps_per_bucket)
+{
+    return target + steps_per_bucket * FEEDER_EJECT_BUCKETS;
+}
+
+// hhmm to minutes after midnight.
+static inline int feeder_hm_to_mins(int hour_mins)
+{
+    return (hour_mins / 100 * 60) + (hour_mins % 100);
+}
+
+// Local time, in seconds since the epoch as if the local clock were UTC, of the feeding on a local day number.
+static inline int64_t feeder_slot_local_s(int64_t local_day, int feeding_time_mins)
+{
+    return local_day * FEEDER_MINS_PER_DAY * 60 + feeding_time_mins * 60;
+}
+
+#ifdef __cplusplus
+namespace feeder {
+
+// Drives a 4 coil unipolar stepper.  Io supplies static output(pin) and write(pin, level); with the pins and drive
+// mode fixed at compile time each step is four writes of constant pins and table bits, with no branches.
+template <typename Io, uint8_t Pin1, uint8_t Pin2, uint8_t Pin3, uint8_t Pin4, feeder_drive_mode_t Mode = FEEDER_DRIVE_WAVE>
+class Stepper
+{
+public:
+    static void begin()
+    {
+        Io::output(Pin1);
+        Io::output(Pin2);
+        Io::output(Pin3);
+        Io::output(Pin4);
+        release();
+    }
+
+    // Advances then energizes, so the first step of a move leaves the phase the rotor rests on.
+    void step(int direction)
+    {
+        phase_ = feeder_next_phase(phase_, direction);
+        write(FEEDER_PHASES[Mode][phase_]);
+    }
+
+    static void release()
+    {
+        write(0);
+    }
+
+private:
+    static void write(uint8_t coils)
+    {
+        Io::write(Pin1, (coils & FEEDER_COIL_1) != 0);
+        Io::write(Pin2, (coils & FEEDER_COIL_2) != 0);
+        Io::write(Pin3, (coils & FEEDER_COIL_3) != 0);
+        Io::write(Pin4, (coils & FEEDER_COIL_4) != 0);
+    }
+
+    int phase_ = 0;
+};
+
+} // namespace feeder
+#endif
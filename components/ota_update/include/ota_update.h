@@ -0,0 +1,12 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Confirms a freshly updated image, then asks CONFIG_OTA_URL for a delta against the running image.  A patch is
+// applied to the inactive OTA slot and verified, and the slot is set to boot next.  Registered as a wifi_time
+// online callback, so it only runs while WiFi is already up for the time sync.
+esp_err_t ota_update_check();
+
+// True once a new image is waiting to boot.  The restart is left to the scheduler, so it happens after WiFi is
+// stopped and once the feeder is idle.
+bool ota_update_restart_pending();
@@ -0,0 +1,230 @@
+#include "ota_update.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_app_desc.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_delta_ota.h"
+#include "mbedtls/sha256.h"
+
+#define OTA_TIMEOUT_MS 10000
+#define PATCH_CHUNK_SIZE 1024
+#define SHA256_LEN 32
+#define SHA256_HEX_LEN (SHA256_LEN * 2)
+#define IMAGE_SHA_HEADER "X-Image-Sha256"
+
+static const char *TAG = "OTA_UPDATE";
+
+// Everything here is only touched from the task running the wifi_time online callbacks.
+static const esp_partition_t *running;
+static esp_ota_handle_t ota_handle;
+static mbedtls_sha256_context image_sha;
+static char expected_sha_hex[SHA256_HEX_LEN + 1];
+static char patch_chunk[PATCH_CHUNK_SIZE];
+static bool restart_pending = false;
+
+// The first successful sync on a new image proves it can still reach the network, so stop the bootloader from
+// rolling back on the next reset.
+static void confirm_running_image()
+{
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_mark_app_valid_cancel_rollback());
+        ESP_LOGI(TAG, "Confirmed image %s", esp_app_get_description()->version);
+    }
+}
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, IMAGE_SHA_HEADER) == 0)
+    {
+        strlcpy(expected_sha_hex, evt->header_value, sizeof(expected_sha_hex));
+    }
+
+    return ESP_OK;
+}
+
+// The patch is applied against the running image, read straight from flash.
+static esp_err_t read_running(uint8_t *buf, size_t size, int offset)
+{
+    return esp_partition_read(running, offset, buf, size);
+}
+
+// Merged image data goes straight to the inactive slot, hashed on the way through.
+static esp_err_t write_update(const uint8_t *buf, size_t size, void *user_data)
+{
+    mbedtls_sha256_update(&image_sha, buf, size);
+
+    return esp_ota_write(ota_handle, buf, size);
+}
+
+static bool sha_matches(const uint8_t *digest)
+{
+    char hex[SHA256_HEX_LEN + 1];
+    for (int i = 0; i < SHA256_LEN; i++)
+    {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+
+    return strcasecmp(hex, expected_sha_hex) == 0;
+}
+
+// Streams the response body through the delta decoder one chunk at a time, so neither the patch nor the image is
+// ever held in RAM.
+static esp_err_t apply_patch(esp_http_client_handle_t client, const esp_partition_t *target)
+{
+    esp_err_t err = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "OTA begin failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = read_running,
+        .write_cb_with_user_data = write_update,
+    };
+    esp_delta_ota_handle_t patch = esp_delta_ota_init(&cfg);
+    if (patch == NULL)
+    {
+        esp_ota_abort(ota_handle);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mbedtls_sha256_init(&image_sha);
+    mbedtls_sha256_starts(&image_sha, 0);
+
+    int patch_len = 0;
+    int read_len;
+    while ((read_len = esp_http_client_read(client, patch_chunk, sizeof(patch_chunk))) > 0)
+    {
+        err = esp_delta_ota_feed_patch(patch, (const uint8_t *)patch_chunk, read_len);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Patch rejected at byte %d: %s", patch_len, esp_err_to_name(err));
+            break;
+        }
+        patch_len += read_len;
+    }
+
+    if (err == ESP_OK && (read_len < 0 || !esp_http_client_is_complete_data_received(client)))
+    {
+        ESP_LOGE(TAG, "Patch download cut short after %d bytes", patch_len);
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_delta_ota_finalize(patch);
+    }
+    esp_delta_ota_deinit(patch);
+
+    uint8_t digest[SHA256_LEN];
+    mbedtls_sha256_finish(&image_sha, digest);
+    mbedtls_sha256_free(&image_sha);
+
+    if (err != ESP_OK)
+    {
+        esp_ota_abort(ota_handle);
+        return err;
+    }
+
+    // Checks the image header, segment checksums and appended digest, and the signature against the key built into
+    // the running image (OTA_ACTIVE depends on CONFIG_SECURE_SIGNED_ON_UPDATE).  The patch and X-Image-Sha256 come
+    // over plain HTTP, so the signature is what stops a forged image.
+    err = esp_ota_end(ota_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Patched image invalid: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    if (!sha_matches(digest))
+    {
+        ESP_LOGE(TAG, "Patched image does not match " IMAGE_SHA_HEADER " %s", expected_sha_hex);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    ESP_LOGI(TAG, "Applied %d byte patch to %s", patch_len, target->label);
+
+    return esp_ota_set_boot_partition(target);
+}
+
+esp_err_t ota_update_check()
+{
+    if (restart_pending)
+    {
+        // Already waiting to boot a new image, which would otherwise be patched against the old one again.
+        return ESP_OK;
+    }
+
+    running = esp_ota_get_running_partition();
+    confirm_running_image();
+
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (target == NULL)
+    {
+        ESP_LOGE(TAG, "No OTA partition to update into");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // The server picks the patch by the running image's ELF digest, so identical builds are never patched twice.
+    char running_sha_hex[SHA256_HEX_LEN + 1];
+    esp_app_get_elf_sha256(running_sha_hex, sizeof(running_sha_hex));
+    expected_sha_hex[0] = '\0';
+
+    esp_http_client_config_t config = {
+        .url = CONFIG_OTA_URL,
+        .timeout_ms = OTA_TIMEOUT_MS,
+        .event_handler = http_event_handler,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    esp_http_client_set_header(client, "X-Elf-Sha256", running_sha_hex);
+    esp_http_client_set_header(client, "X-App-Version", esp_app_get_description()->version);
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) < 0)
+    {
+        err = ESP_FAIL;
+    }
+
+    if (err == ESP_OK)
+    {
+        int status = esp_http_client_get_status_code(client);
+        if (status == 204)
+        {
+            ESP_LOGI(TAG, "Firmware up to date");
+        }
+        else if (status != 200)
+        {
+            ESP_LOGW(TAG, "No patch for this image: %d", status);
+        }
+        else if (strlen(expected_sha_hex) != SHA256_HEX_LEN)
+        {
+            ESP_LOGE(TAG, "Patch without " IMAGE_SHA_HEADER);
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+        else
+        {
+            err = apply_patch(client, target);
+            restart_pending = err == ESP_OK;
+        }
+    }
+    esp_http_client_cleanup(client);
+
+    return err;
+}
+
+bool ota_update_restart_pending()
+{
+    return restart_pending;
+}
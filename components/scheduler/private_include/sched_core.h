@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Feeding and clock sync decisions.  Wall and monotonic time are passed in rather than read, so the same
+// logic runs on the device and in the host simulator against a virtual clock.
+//
+// The next feeding is kept as an absolute UTC time, worked out from a cached table of the timezone's DST
+// transitions.  Between feedings and clock syncs each wakeup only compares integers.
+
+// Everything needed to carry on after a deep sleep, when RAM and the uptime counter are lost.  The sync deadline
+// is kept as wall time because uptime restarts on every wake.
+typedef struct {
+    time_t next_feed;
+    time_t last_fed_slot;
+    time_t next_sync;
+} sched_core_state_t;
+
+void sched_core_init(int feeding_time_hm);
+
+// Picks up a new feeding time or timezone.  The next slot after now is kept unless it falls on the local date
+// that was already fed.
+void sched_core_reschedule(int feeding_time_hm, time_t now);
+
+// True once the wall clock has been set at least once.
+bool sched_core_time_valid(time_t now);
+
+void sched_core_save(sched_core_state_t *state, time_t now, int64_t uptime_us);
+
+// Call after sched_core_init() on a wake from deep sleep.
+void sched_core_restore(const sched_core_state_t *state, time_t now, int64_t uptime_us);
+
+bool sched_core_sync_due(int64_t uptime_us);
+
+// now is the wall clock right after the sync attempt.  A successful sync recomputes the next feeding.
+void sched_core_sync_done(int64_t uptime_us, time_t now, bool success);
+
+// Call once per wakeup.  True once now has reached the next feeding time; a slot that was slept or stepped past
+// is fed late rather than missed, and never more than once a day.
+bool sched_core_feed_due(time_t now);
+
+// Seconds until the next feeding or clock sync, whichever comes first.
+uint32_t sched_core_sleep_secs(time_t now, int64_t uptime_us);
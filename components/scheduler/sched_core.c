@@ -0,0 +1,278 @@
+#include "sched_core.h"
+#include "esp_log.h"
+#include "feeder_core.h"
+
+#define CLOCK_UPDATE_COOLDOWN_MINS (60*24*7*4)
+#define CLOCK_RETRY_MINS 60
+// Anything earlier (2024-01-01) means the clock has never been set.
+#define MIN_VALID_TIME 1704067200
+#define SECS_PER_DAY 86400
+// Upper bound on a single sleep, so the loop still comes round for trace dumps and late clock corrections.
+#define MAX_SLEEP_SECS (60 * 60)
+// The cached offset table spans a little over a year from when it was built.
+#define TZ_TABLE_DAYS 400
+#define MAX_TZ_TRANSITIONS 8
+
+typedef struct {
+    time_t at;
+    int32_t offset_s; // local minus UTC from this moment on
+} tz_transition_t;
+
+typedef struct {
+    time_t start;
+    time_t end;
+    int32_t base_offset_s;
+    tz_transition_t transitions[MAX_TZ_TRANSITIONS];
+    int count;
+} tz_table_t;
+
+static const char *TAG = "SCHED_CORE";
+
+static int feeding_time_mins;
+static int64_t next_sync_us;
+static time_t next_feed;
+static time_t last_fed_slot;
+static tz_table_t tz_table;
+
+// Days since 1970-01-01 of the local calendar date, so consecutive dates stay consecutive across years.
+static int32_t local_day_number(const struct tm *timeinfo)
+{
+    int32_t year = timeinfo->tm_year + 1900;
+    int32_t leap_days = (year - 1969) / 4 - (year - 1901) / 100 + (year - 1601) / 400;
+
+    return (year - 1970) * 365 + leap_days + timeinfo->tm_yday;
+}
+
+static int32_t libc_utc_offset(time_t t)
+{
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    int64_t local_s = (int64_t)local_day_number(&timeinfo) * SECS_PER_DAY + timeinfo.tm_hour * 3600 + timeinfo.tm_min * 60 + timeinfo.tm_sec;
+
+    return local_s - t;
+}
+
+// Walks the TZ rules a day at a time and bisects each offset change down to the second.  This is the only place
+// the scheduler asks libc about the timezone, once a year or after a clock sync.
+static void build_tz_table(time_t now)
+{
+    tz_table.start = now - SECS_PER_DAY;
+    tz_table.end = tz_table.start + (time_t)TZ_TABLE_DAYS * SECS_PER_DAY;
+    tz_table.base_offset_s = libc_utc_offset(tz_table.start);
+    tz_table.count = 0;
+
+    int32_t prev_offset_s = tz_table.base_offset_s;
+    for (time_t t = tz_table.start + SECS_PER_DAY; t <= tz_table.end && tz_table.count < MAX_TZ_TRANSITIONS; t += SECS_PER_DAY)
+    {
+        int32_t offset_s = libc_utc_offset(t);
+        if (offset_s == prev_offset_s)
+        {
+            continue;
+        }
+
+        time_t lo = t - SECS_PER_DAY;
+        time_t hi = t;
+        while (hi - lo > 1)
+        {
+            time_t mid = lo + (hi - lo) / 2;
+            if (libc_utc_offset(mid) == prev_offset_s)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        tz_table.transitions[tz_table.count++] = (tz_transition_t){.at = hi, .offset_s = offset_s};
+        prev_offset_s = offset_s;
+    }
+
+    ESP_LOGD(TAG, "Timezone table from %lld: base offset %ld, %d transitions", (long long)tz_table.start, tz_table.base_offset_s, tz_table.count);
+}
+
+static void ensure_tz_table(time_t t)
+{
+    // Leave room for looking up to two days ahead of t.
+    if (t < tz_table.start || t > tz_table.end - 2 * SECS_PER_DAY)
+    {
+        build_tz_table(t);
+    }
+}
+
+static int32_t utc_offset(time_t t)
+{
+    int32_t offset_s = tz_table.base_offset_s;
+    for (int i = 0; i < tz_table.count && t >= tz_table.transitions[i].at; i++)
+    {
+        offset_s = tz_table.transitions[i].offset_s;
+    }
+
+    return offset_s;
+}
+
+// Earliest UTC time showing the given local time.  A time inside the DST fall back hour happens twice and the
+// first one wins; a time skipped by the spring forward maps to the moment the clock jumps past it.
+static time_t local_to_utc(int64_t local_s)
+{
+    time_t best = -1;
+    int32_t prev_offset_s = tz_table.base_offset_s;
+    for (int i = -1; i < tz_table.count; i++)
+    {
+        int32_t offset_s = i < 0 ? tz_table.base_offset_s : tz_table.transitions[i].offset_s;
+        time_t t = local_s - offset_s;
+        if (utc_offset(t) == offset_s && (best < 0 || t < best))
+        {
+            best = t;
+        }
+    }
+
+    if (best >= 0)
+    {
+        return best;
+    }
+
+    for (int i = 0; i < tz_table.count; i++)
+    {
+        const tz_transition_t *transition = &tz_table.transitions[i];
+        if (local_s >= transition->at + prev_offset_s && local_s < transition->at + transition->offset_s)
+        {
+            return transition->at;
+        }
+        prev_offset_s = transition->offset_s;
+    }
+
+    return local_s - tz_table.base_offset_s;
+}
+
+static int64_t local_day(time_t t)
+{
+    return (t + utc_offset(t)) / SECS_PER_DAY;
+}
+
+// First feeding slot strictly after t.
+static time_t next_slot_after(time_t t)
+{
+    ensure_tz_table(t);
+    int64_t day = local_day(t);
+
+    time_t slot = t;
+    for (int i = 0; i < 3 && slot <= t; i++)
+    {
+        slot = local_to_utc(feeder_slot_local_s(day + i, feeding_time_mins));
+    }
+
+    return slot;
+}
+
+void sched_core_init(int feeding_time_hm)
+{
+    feeding_time_mins = feeder_hm_to_mins(feeding_time_hm);
+    next_sync_us = 0;
+    next_feed = 0;
+    last_fed_slot = 0;
+    tz_table = (tz_table_t){0};
+}
+
+void sched_core_reschedule(int feeding_time_hm, time_t now)
+{
+    feeding_time_mins = feeder_hm_to_mins(feeding_time_hm);
+    tz_table = (tz_table_t){0};
+    if (next_feed == 0 || now < MIN_VALID_TIME)
+    {
+        // Worked out on the next sched_core_feed_due() instead.
+        return;
+    }
+
+    build_tz_table(now);
+    next_feed = next_slot_after(now);
+    if (last_fed_slot != 0 && local_day(next_feed) == local_day(last_fed_slot))
+    {
+        next_feed = next_slot_after(next_feed);
+    }
+    ESP_LOGI(TAG, "Rescheduled, next feeding in %lld s", (long long)(next_feed - now));
+}
+
+bool sched_core_time_valid(time_t now)
+{
+    return now >= MIN_VALID_TIME;
+}
+
+void sched_core_save(sched_core_state_t *state, time_t now, int64_t uptime_us)
+{
+    state->next_feed = next_feed;
+    state->last_fed_slot = last_fed_slot;
+    state->next_sync = now + (next_sync_us - uptime_us) / 1000000;
+}
+
+void sched_core_restore(const sched_core_state_t *state, time_t now, int64_t uptime_us)
+{
+    next_feed = state->next_feed;
+    last_fed_slot = state->last_fed_slot;
+    next_sync_us = uptime_us + (int64_t)(state->next_sync - now) * 1000000;
+}
+
+bool sched_core_sync_due(int64_t uptime_us)
+{
+    return uptime_us >= next_sync_us;
+}
+
+void sched_core_sync_done(int64_t uptime_us, time_t now, bool success)
+{
+    next_sync_us = uptime_us + (int64_t)(success ? CLOCK_UPDATE_COOLDOWN_MINS : CLOCK_RETRY_MINS) * 60 * 1000000;
+
+    if (success && now >= MIN_VALID_TIME && next_feed != 0)
+    {
+        // The clock may have stepped, so rebuild around the new time.  Measuring from the last fed slot keeps a step
+        // back from feeding the same day twice and a step forward over the slot from skipping it.
+        build_tz_table(now);
+        next_feed = next_slot_after(last_fed_slot != 0 ? last_fed_slot : next_feed - 1);
+        ESP_LOGI(TAG, "Next feeding in %lld s", (long long)(next_feed - now));
+    }
+}
+
+bool sched_core_feed_due(time_t now)
+{
+    if (now < MIN_VALID_TIME)
+    {
+        next_feed = 0;
+        return false;
+    }
+
+    if (next_feed == 0)
+    {
+        next_feed = next_slot_after(now);
+        ESP_LOGI(TAG, "Next feeding in %lld s", (long long)(next_feed - now));
+        return false;
+    }
+
+    if (now < next_feed)
+    {
+        return false;
+    }
+
+    last_fed_slot = next_feed;
+    next_feed = next_slot_after(now);
+    ESP_LOGI(TAG, "Next feeding in %lld s", (long long)(next_feed - now));
+
+    return true;
+}
+
+uint32_t sched_core_sleep_secs(time_t now, int64_t uptime_us)
+{
+    int64_t sleep_s = MAX_SLEEP_SECS;
+
+    int64_t until_sync_s = (next_sync_us - uptime_us + 999999) / 1000000;
+    if (until_sync_s < sleep_s)
+    {
+        sleep_s = until_sync_s;
+    }
+
+    if (next_feed != 0 && next_feed - now < sleep_s)
+    {
+        sleep_s = next_feed - now;
+    }
+
+    return sleep_s < 1 ? 1 : sleep_s;
+}
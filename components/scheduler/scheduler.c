@@ -6,43 +6,74 @@
 #include "esp_log.h"
 #include "time.h"
 #include "esp_sleep.h"
+#include "esp_system.h"
 #include "feeder_control.h"
 #include "sdkconfig.h"
 #include "buzzer_music.h"
 #include "buzzer_control.h"
 #include "esp_timer.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "energy.h"
+#include "sched_core.h"
+#include "boot_stages.h"
+#include "diagnostics.h"
+#include "feeder_config.h"
+#include "ota_update.h"
 
-#define CLOCK_UPDATE_COOLDOWN_MINS (60*24*7*4)
+#define SCHEDULER_TASK_STACK_SIZE 4096
+// A deep sleep wake can boot a new image set by an OTA update, so the magic changes with the layout.
+#define RTC_STATE_MAGIC (0x46534452 ^ (uint32_t)sizeof(rtc_state_t))
+// How often to look again while waiting for the feeder and buzzer to go idle before a deep sleep.
+#define DEEP_SLEEP_POLL_SECS 1
+// How often to look again for the end of a feeding move.
+#define FEED_REPORT_POLL_SECS 1
+// A restart into a new image waits until the feeder is idle, and is put off when the next feeding is closer than
+// this, since the boot's time sync would run past it.
+#define RESTART_POLL_SECS 1
+#define RESTART_MIN_LEAD_SECS 120
+#define ARRAY_LEN(array) (sizeof(array) / sizeof((array)[0]))
+#define BOOT_MUSIC "o5l2co6c"
+#define READY_MUSIC "o5l1cr1fr1ar1o6cr1cccr1o5ar1aaar1fr1ar1fr1l2c"
+#define FEED_MUSIC "o5l2cgo6er1o5cgo6er1"
+// Every note or rest takes at least one character, so the length of the string bounds its frame count.
+#define MUSIC_FRAMES(music_str) (sizeof(music_str) - 1)
 
 static const char *TAG = "FISH_FEED_SCHEDULER";
 
-static int64_t clock_update_cooldown_micros;
-static int64_t last_clock_update_micros;
 static time_t now = 0;
-static uint16_t sleep_time_mins;
-static struct tm timeinfo;
+static uint32_t sleep_time_secs;
+// Set by a feeding, cleared once the move is over and its stats are logged.
+static bool feed_report_pending = false;
+static bool fast_wake = false;
+static bool audio_ready = false;
+static volatile bool config_changed = false;
+static TaskHandle_t loop_task;
 
-static int feeding_time_mins;
-static int minute_of_day;
-static int last_tick_minutes;
+typedef struct {
+    uint32_t magic;
+    sched_core_state_t core;
+    uint32_t wakeups;
+    uint64_t awake_us;
+} rtc_state_t;
 
-static buzzer_pattern_t* boot_music;
-static buzzer_pattern_t* ready_music;
-static buzzer_pattern_t* feed_music;
+static RTC_DATA_ATTR rtc_state_t rtc_state;
 
-static int hm_to_mins(int hour_mins)
-{
-    return (hour_mins / 100 * 60) + (hour_mins % 100);
-}
+static buzzer_pattern_t boot_music;
+static buzzer_pattern_t ready_music;
+static buzzer_pattern_t feed_music;
+static buzzer_keyframe_t boot_frames[MUSIC_FRAMES(BOOT_MUSIC)];
+static buzzer_keyframe_t ready_frames[MUSIC_FRAMES(READY_MUSIC)];
+static buzzer_keyframe_t feed_frames[MUSIC_FRAMES(FEED_MUSIC)];
 
-static uint16_t mins_until_next_wakeup()
-{
-    return 1;
-}
+static StackType_t loop_task_stack[SCHEDULER_TASK_STACK_SIZE];
+static StaticTask_t loop_task_buffer;
 
-static void update_internal_clock()
+static esp_err_t update_internal_clock()
 {
     esp_err_t ret = blocking_update_time();
+    telemetry_record(TELEMETRY_EVT_SYNC, ret == ESP_OK);
+    sched_core_sync_done(esp_timer_get_time(), time(NULL), ret == ESP_OK);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "failed to update time");
@@ -50,81 +81,232 @@ static void update_internal_clock()
     else
     {
         ESP_LOGD(TAG, "successfully updated clock");
-        last_clock_update_micros = esp_timer_get_time();
     }
+
+    return ret;
+}
+
+static esp_err_t init_pattern(const char* music_str, buzzer_pattern_t* pattern, buzzer_keyframe_t* frames, int max_frames) {
+    esp_err_t ret = parse_music_str(music_str, pattern, frames, max_frames);
+    pattern->waveform = BUZZER_WAV_SQUARE;
+    pattern->loop = false;
+
+    return ret;
+}
+
+static void init_music() {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(init_pattern(BOOT_MUSIC, &boot_music, boot_frames, ARRAY_LEN(boot_frames)));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(init_pattern(READY_MUSIC, &ready_music, ready_frames, ARRAY_LEN(ready_frames)));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(init_pattern(FEED_MUSIC, &feed_music, feed_frames, ARRAY_LEN(feed_frames)));
+}
+
+static void ensure_audio()
+{
+    if (!audio_ready)
+    {
+        init_music();
+        audio_ready = buzzer_control_init() == ESP_OK;
+    }
+}
+
+// A timer or button wake from our own deep sleep, with the clock still set, can carry on from RTC memory.
+static bool is_fast_wake()
+{
+#ifdef CONFIG_DEEP_SLEEP_ACTIVE
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+
+    return esp_reset_reason() == ESP_RST_DEEPSLEEP && (cause == ESP_SLEEP_WAKEUP_TIMER || cause == ESP_SLEEP_WAKEUP_EXT0) &&
+           rtc_state.magic == RTC_STATE_MAGIC && sched_core_time_valid(time(NULL));
+#else
+    return false;
+#endif
+}
+
+#ifdef CONFIG_DEEP_SLEEP_ACTIVE
+static void enter_deep_sleep(uint32_t secs)
+{
+    int64_t awake_us = esp_timer_get_time();
+    sched_core_save(&rtc_state.core, time(NULL), awake_us);
+    rtc_state.magic = RTC_STATE_MAGIC;
+    rtc_state.wakeups++;
+    rtc_state.awake_us += awake_us;
+    ESP_LOGI(TAG, "Deep sleep for %lu s after %lld ms awake, %llu ms average over %lu wakeups", secs, awake_us / 1000,
+             rtc_state.awake_us / rtc_state.wakeups / 1000, rtc_state.wakeups);
+
+    energy_prepare_deep_sleep();
+    esp_sleep_enable_timer_wakeup((uint64_t)secs * 1000000);
+    esp_deep_sleep_start();
+}
+#endif
+
+static void scheduler_init()
+{
+    sched_core_init(feeder_config_get()->feeding_time);
+    if (fast_wake)
+    {
+        // A sync that has come due runs in the loop like any other.
+        sched_core_restore(&rtc_state.core, time(NULL), esp_timer_get_time());
+        boot_stage_skip(BOOT_STAGE_TIME);
+        return;
+    }
+
+    boot_stage_begin(BOOT_STAGE_TIME);
+    esp_err_t ret = update_internal_clock();
+    boot_stage_done(BOOT_STAGE_TIME, ret == ESP_OK);
+
+    // Audio init is much quicker than a WiFi connect, so this rarely waits.
+    boot_stages_wait(BOOT_STAGE_BIT(BOOT_STAGE_AUDIO), portMAX_DELAY);
+    if (boot_stage_ok(BOOT_STAGE_AUDIO))
+    {
+        buzzer_control_play_pattern(&ready_music);
+    }
+
+    diagnostics_mark_boot();
+    diagnostics_log_tasks();
+}
+
+// Runs on the task that changed the settings.  Cuts the current sleep short so a new feeding time is not slept past,
+// and leaves the timezone to the loop.
+static void on_config_change()
+{
+    config_changed = true;
+    xTaskNotifyGive(loop_task);
 }
 
 static void scheduler_loop_task(void *arg)
 {
     ESP_LOGD(TAG, "Started update task");
+    scheduler_init();
+
     while (true)
     {
-        ESP_LOGI(TAG, "Tick loop");
-        if (esp_timer_get_time() - last_clock_update_micros > clock_update_cooldown_micros)
+        ESP_LOGD(TAG, "Tick loop");
+        if (sched_core_sync_due(esp_timer_get_time()))
         {
             update_internal_clock();
         }
 
         time(&now);
-        localtime_r(&now, &timeinfo);
-        ESP_LOGI(TAG, "Updating for time: %.2d:%.2d", timeinfo.tm_hour, timeinfo.tm_min);
+        if (config_changed)
+        {
+            config_changed = false;
+            // Here rather than on the updating task, since sched_core calls localtime() on this one.
+            feeder_config_apply_timezone();
+            sched_core_reschedule(feeder_config_get()->feeding_time, now);
+        }
 
-        minute_of_day = timeinfo.tm_hour * 60 + timeinfo.tm_min;
+        if (feed_report_pending && feeder_control_idle_for(0))
+        {
+            // Logged from here rather than the step task, so it stays off the motor core.
+            feeder_control_log_jitter();
+#ifdef CONFIG_TRACE_DUMP_AFTER_FEED
+            trace_dump();
+#endif
+            feed_report_pending = false;
+        }
 
-        ESP_LOGW(TAG, "minute: %d, feeding: %d, last min: %d", minute_of_day, feeding_time_mins, last_tick_minutes);
-        if (last_tick_minutes > 0 && minute_of_day >= feeding_time_mins && last_tick_minutes < feeding_time_mins)
+        if (sched_core_feed_due(now))
         {
             ESP_LOGI(TAG, "Feeding time!");
             extend_bucket();
-            buzzer_control_play_pattern(boot_music);
+            ensure_audio();
+            if (audio_ready)
+            {
+                buzzer_control_play_pattern(&boot_music);
+            }
+            feed_report_pending = true;
+            energy_log_stats();
+            diagnostics_log_tasks();
+#ifdef CONFIG_JITTER_TEST_SYNC_ON_FEED
+            // Deliberately overlap a time sync with the move to measure its effect on step timing.
+            update_internal_clock();
+#endif
         }
 
-        last_tick_minutes = minute_of_day;
+        sleep_time_secs = sched_core_sleep_secs(now, esp_timer_get_time());
+        if (feed_report_pending)
+        {
+            // Come back once the move has finished rather than at the next event.
+            sleep_time_secs = sleep_time_secs < FEED_REPORT_POLL_SECS ? sleep_time_secs : FEED_REPORT_POLL_SECS;
+        }
+#ifdef CONFIG_OTA_ACTIVE
+        if (ota_update_restart_pending() && sleep_time_secs >= RESTART_MIN_LEAD_SECS)
+        {
+            // WiFi is already off again, the sync that applied the update has returned.
+            if (feeder_control_idle_for(0) && !(audio_ready && buzzer_control_is_playing()))
+            {
+                ESP_LOGI(TAG, "Restarting into the new image");
+                feeder_control_prepare_restart();
+                esp_restart();
+            }
+            sleep_time_secs = RESTART_POLL_SECS;
+        }
+#endif
+#ifdef CONFIG_DEEP_SLEEP_ACTIVE
+        if (!feeder_control_idle_for((int64_t)CONFIG_DEEP_SLEEP_IDLE_SECS * 1000000) || (audio_ready && buzzer_control_is_playing()))
+        {
+            // Look again shortly rather than light sleeping through to the next event.
+            sleep_time_secs = sleep_time_secs < DEEP_SLEEP_POLL_SECS ? sleep_time_secs : DEEP_SLEEP_POLL_SECS;
+        }
+        else if (sched_core_time_valid(now) && feeder_control_prepare_deep_sleep())
+        {
+            enter_deep_sleep(sleep_time_secs);
+        }
+#endif
 #ifdef CONFIG_SLEEP_ACTIVE
-        sleep_time_mins = mins_until_next_wakeup();
-        ESP_LOGI(TAG, "Sleeping for %d seconds", sleep_time_mins * 60);
-        esp_sleep_enable_timer_wakeup((uint64_t)sleep_time_mins * 60e6);
+        ESP_LOGI(TAG, "Sleeping for %lu seconds", sleep_time_secs);
+#ifdef CONFIG_PM_ENABLE
+        // Automatic light sleep takes over whenever every task is blocked and no PM lock is held.
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep_time_secs * 1000));
+#else
+        esp_sleep_enable_timer_wakeup((uint64_t)sleep_time_secs * 1000000);
         vTaskDelay(50 / portTICK_PERIOD_MS);
+        trace_record(TRACE_EVT_SLEEP_ENTER, sleep_time_secs);
+        energy_begin(ENERGY_STATE_SLEEP);
         esp_light_sleep_start();
+        energy_end(ENERGY_STATE_SLEEP);
+        diagnostics_record_wakeup(esp_sleep_get_wakeup_cause(), false);
+        trace_record_timed(TRACE_EVT_SLEEP_EXIT, esp_sleep_get_wakeup_cause());
+#endif
 #else
-        vTaskDelay(60000 / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep_time_secs * 1000));
 #endif
     }
 
     vTaskDelete(NULL);
 }
 
-static void init_music() {
-    parse_music_str("o5l2co6c", &boot_music);
-    boot_music->waveform = BUZZER_WAV_SQUARE;
-    boot_music->loop = false;
-
-    parse_music_str("o5l1cr1fr1ar1o6cr1cccr1o5ar1aaar1fr1ar1fr1l2c", &ready_music);
-    ready_music->waveform = BUZZER_WAV_SQUARE;
-    ready_music->loop = false;
-
-    parse_music_str("o5l2cgo6er1o5cgo6er1", &feed_music);
-    feed_music->waveform = BUZZER_WAV_SQUARE;
-    feed_music->loop = false;
-}
-
-static void scheduler_init()
+static void init_audio()
 {
-    feeding_time_mins = hm_to_mins(CONFIG_FEEDING_TIME);
-    clock_update_cooldown_micros = CLOCK_UPDATE_COOLDOWN_MINS * 60 * 1e6;
-    update_internal_clock();
+    boot_stage_begin(BOOT_STAGE_AUDIO);
+    init_music();
+    esp_err_t ret = buzzer_control_init();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ret);
+    if (ret == ESP_OK)
+    {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(buzzer_control_play_pattern(&boot_music));
+    }
+    audio_ready = ret == ESP_OK;
+    boot_stage_done(BOOT_STAGE_AUDIO, ret == ESP_OK);
 }
 
 esp_err_t scheduler_start()
 {
-    init_music();
-    ESP_ERROR_CHECK_WITHOUT_ABORT(buzzer_control_init());
-    ESP_ERROR_CHECK_WITHOUT_ABORT(buzzer_control_play_pattern(boot_music));
-    scheduler_init();
-    buzzer_control_play_pattern(ready_music);
+    fast_wake = is_fast_wake();
 
-    xTaskCreate(scheduler_loop_task, "scheduler loop", 4096, NULL, 5, NULL);
-    
+    // The loop task starts on the first time sync straight away, while audio comes up here on the caller's task.
+    // The loop plays the ready chime once both are done.  A fast wake skips both and the chimes.
+    loop_task = xTaskCreateStaticPinnedToCore(scheduler_loop_task, "scheduler loop", SCHEDULER_TASK_STACK_SIZE, NULL,
+                                              CONFIG_SCHEDULER_TASK_PRIORITY, loop_task_stack, &loop_task_buffer, CONFIG_NETWORK_TASK_CORE);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(feeder_config_register_change_cb(on_config_change));
+    if (fast_wake)
+    {
+        boot_stage_skip(BOOT_STAGE_AUDIO);
+    }
+    else
+    {
+        init_audio();
+    }
 
     return ESP_OK;
 }
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+
+typedef enum {
+    TELEMETRY_EVT_BOOT = 0,
+    TELEMETRY_EVT_FEED,
+    TELEMETRY_EVT_CALIBRATE,
+    TELEMETRY_EVT_BUTTON,
+    TELEMETRY_EVT_SYNC,
+    TELEMETRY_EVT_BROWNOUT,
+} telemetry_event_t;
+
+esp_err_t telemetry_init();
+
+// Append an event to the flash ring.  Oldest sector is dropped when the ring is full.
+esp_err_t telemetry_record(telemetry_event_t event, uint16_t arg);
+
+// Upload stored events in POSTs of up to 128 and drop each batch once the server accepts it.  Only call with WiFi
+// up.  Recording carries on meanwhile.
+esp_err_t telemetry_flush();
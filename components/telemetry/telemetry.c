@@ -0,0 +1,370 @@
+#include "telemetry.h"
+#include <string.h>
+#include <time.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+
+#define TELEMETRY_PARTITION_SUBTYPE 0x40
+#define TELEMETRY_PARTITION_LABEL "telemetry"
+#define TELEMETRY_SECTOR_SIZE 4096
+#define TELEMETRY_SECTOR_MAGIC 0x4C544646   // "FFTL"
+#define TELEMETRY_BATCH_MAGIC 0x31544246    // "FBT1"
+#define SLOTS_PER_SECTOR (TELEMETRY_SECTOR_SIZE / sizeof(telemetry_slot_t))
+#define READ_CHUNK_SLOTS 32
+#define UPLOAD_TIMEOUT_MS 5000
+#define UPLOAD_BATCH_SLOTS 128
+
+// Slot 0 of every sector holds a sector_header_t, the rest hold records.
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    uint16_t arg;
+    uint8_t event;
+    uint8_t check;  // ~event, so erased (0xFF) or torn slots never read as valid
+} telemetry_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} sector_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} batch_header_t;
+
+// A copy of the oldest records, so the upload runs without holding the mutex.
+typedef struct {
+    telemetry_slot_t slots[UPLOAD_BATCH_SLOTS];
+    uint32_t offsets[UPLOAD_BATCH_SLOTS];
+    int count;
+} upload_batch_t;
+
+typedef bool (*record_visitor_t)(const telemetry_slot_t *slot, uint32_t offset, void *ctx);
+
+static const char *TAG = "TELEMETRY";
+
+static const esp_partition_t *partition;
+static SemaphoreHandle_t telemetry_mutex;
+static StaticSemaphore_t telemetry_mutex_buffer;
+static int sector_count;
+static int head_sector;
+static int head_slot;
+static uint32_t head_seq;
+static upload_batch_t upload;
+
+static bool slot_is_valid(const telemetry_slot_t *slot)
+{
+    return slot->check == (uint8_t)~slot->event;
+}
+
+static bool slot_is_erased(const telemetry_slot_t *slot)
+{
+    return slot->timestamp == UINT32_MAX && slot->arg == UINT16_MAX && slot->event == UINT8_MAX && slot->check == UINT8_MAX;
+}
+
+static bool read_sector_header(const esp_partition_t *part, int sector, sector_header_t *header)
+{
+    if (esp_partition_read(part, sector * TELEMETRY_SECTOR_SIZE, header, sizeof(*header)) != ESP_OK)
+    {
+        return false;
+    }
+
+    return header->magic == TELEMETRY_SECTOR_MAGIC;
+}
+
+static esp_err_t start_sector(const esp_partition_t *part, int sector, uint32_t seq)
+{
+    sector_header_t header = {
+        .magic = TELEMETRY_SECTOR_MAGIC,
+        .seq = seq,
+    };
+
+    esp_err_t err = esp_partition_erase_range(part, sector * TELEMETRY_SECTOR_SIZE, TELEMETRY_SECTOR_SIZE);
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(part, sector * TELEMETRY_SECTOR_SIZE, &header, sizeof(header));
+    }
+
+    head_sector = sector;
+    head_slot = 1;
+    head_seq = seq;
+
+    return err;
+}
+
+// Takes the partition rather than using the global, which is only set once the head is known.
+static esp_err_t find_head(const esp_partition_t *part)
+{
+    sector_header_t header;
+    telemetry_slot_t slot;
+
+    head_sector = -1;
+    for (int i = 0; i < sector_count; i++)
+    {
+        if (read_sector_header(part, i, &header) && (head_sector < 0 || header.seq > head_seq))
+        {
+            head_sector = i;
+            head_seq = header.seq;
+        }
+    }
+
+    if (head_sector < 0)
+    {
+        ESP_LOGI(TAG, "Formatting telemetry ring");
+        return start_sector(part, 0, 1);
+    }
+
+    for (head_slot = 1; head_slot < SLOTS_PER_SECTOR; head_slot++)
+    {
+        esp_partition_read(part, head_sector * TELEMETRY_SECTOR_SIZE + head_slot * sizeof(slot), &slot, sizeof(slot));
+        if (slot_is_erased(&slot))
+        {
+            break;
+        }
+    }
+
+    return ESP_OK;
+}
+
+// Visits valid records oldest first, along with their offset in the partition.  Sectors are written in index
+// order, so the oldest follows the head.
+static bool for_each_record(record_visitor_t visitor, void *ctx)
+{
+    telemetry_slot_t chunk[READ_CHUNK_SLOTS];
+    sector_header_t header;
+
+    for (int i = 1; i <= sector_count; i++)
+    {
+        int sector = (head_sector + i) % sector_count;
+        if (!read_sector_header(partition, sector, &header))
+        {
+            continue;
+        }
+
+        int end_slot = sector == head_sector ? head_slot : SLOTS_PER_SECTOR;
+        for (int slot_idx = 1; slot_idx < end_slot; slot_idx += READ_CHUNK_SLOTS)
+        {
+            int read_count = end_slot - slot_idx < READ_CHUNK_SLOTS ? end_slot - slot_idx : READ_CHUNK_SLOTS;
+            uint32_t offset = sector * TELEMETRY_SECTOR_SIZE + slot_idx * sizeof(telemetry_slot_t);
+            if (esp_partition_read(partition, offset, chunk, read_count * sizeof(telemetry_slot_t)) != ESP_OK)
+            {
+                return false;
+            }
+
+            for (int j = 0; j < read_count; j++)
+            {
+                if (slot_is_valid(&chunk[j]) && !visitor(&chunk[j], offset + j * sizeof(telemetry_slot_t), ctx))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool collect_record(const telemetry_slot_t *slot, uint32_t offset, void *ctx)
+{
+    upload_batch_t *batch = ctx;
+    batch->slots[batch->count] = *slot;
+    batch->offsets[batch->count] = offset;
+    batch->count++;
+
+    return batch->count < UPLOAD_BATCH_SLOTS;
+}
+
+// Zeroes the uploaded slots, which no longer pass the check byte.  A slot that has changed since it was copied
+// belongs to a sector the ring has since reused, so it is left alone.
+static esp_err_t consume_batch(const upload_batch_t *batch)
+{
+    static const telemetry_slot_t consumed = {0};
+    telemetry_slot_t slot;
+    esp_err_t err = ESP_OK;
+
+    for (int i = 0; i < batch->count && err == ESP_OK; i++)
+    {
+        err = esp_partition_read(partition, batch->offsets[i], &slot, sizeof(slot));
+        if (err == ESP_OK && memcmp(&slot, &batch->slots[i], sizeof(slot)) == 0)
+        {
+            err = esp_partition_write(partition, batch->offsets[i], &consumed, sizeof(consumed));
+        }
+    }
+
+    return err;
+}
+
+static esp_err_t upload_batch(const upload_batch_t *batch)
+{
+    esp_http_client_config_t config = {
+        .url = CONFIG_TELEMETRY_URL,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = UPLOAD_TIMEOUT_MS,
+    };
+    batch_header_t header = {
+        .magic = TELEMETRY_BATCH_MAGIC,
+        .count = batch->count,
+    };
+    int records_len = batch->count * sizeof(telemetry_slot_t);
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_err_t err = esp_http_client_open(client, sizeof(header) + records_len);
+    if (err == ESP_OK)
+    {
+        if (esp_http_client_write(client, (const char *)&header, sizeof(header)) != sizeof(header) ||
+            esp_http_client_write(client, (const char *)batch->slots, records_len) != records_len)
+        {
+            ESP_LOGE(TAG, "Failed to write telemetry batch");
+            err = ESP_FAIL;
+        }
+        else if (esp_http_client_fetch_headers(client) < 0)
+        {
+            err = ESP_FAIL;
+        }
+        else
+        {
+            int status = esp_http_client_get_status_code(client);
+            if (status < 200 || status >= 300)
+            {
+                ESP_LOGE(TAG, "Telemetry upload rejected: %d", status);
+                err = ESP_FAIL;
+            }
+        }
+    }
+    esp_http_client_cleanup(client);
+
+    return err;
+}
+
+esp_err_t telemetry_init()
+{
+    // Other tasks may already be recording.  Until the head has been found they see no partition and drop the
+    // event; one that sees it just as it is set blocks on the mutex until init lets go.
+    telemetry_mutex = xSemaphoreCreateMutexStatic(&telemetry_mutex_buffer);
+    xSemaphoreTake(telemetry_mutex, portMAX_DELAY);
+
+    const esp_partition_t *found = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TELEMETRY_PARTITION_SUBTYPE, TELEMETRY_PARTITION_LABEL);
+    if (found == NULL)
+    {
+        ESP_LOGE(TAG, "No telemetry partition");
+        xSemaphoreGive(telemetry_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    sector_count = found->size / TELEMETRY_SECTOR_SIZE;
+    if (sector_count < 2)
+    {
+        ESP_LOGE(TAG, "Telemetry partition too small");
+        xSemaphoreGive(telemetry_mutex);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = find_head(found);
+    if (err == ESP_OK)
+    {
+        partition = found;
+    }
+    xSemaphoreGive(telemetry_mutex);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // Deep sleep wakeups are routine and would flood the ring.
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (reason != ESP_RST_DEEPSLEEP)
+    {
+        telemetry_record(TELEMETRY_EVT_BOOT, reason);
+    }
+    if (reason == ESP_RST_BROWNOUT)
+    {
+        telemetry_record(TELEMETRY_EVT_BROWNOUT, 0);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t telemetry_record(telemetry_event_t event, uint16_t arg)
+{
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    telemetry_slot_t slot = {
+        .timestamp = (uint32_t)time(NULL),
+        .arg = arg,
+        .event = (uint8_t)event,
+        .check = (uint8_t)~event,
+    };
+
+    xSemaphoreTake(telemetry_mutex, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (head_slot == SLOTS_PER_SECTOR)
+    {
+        err = start_sector(partition, (head_sector + 1) % sector_count, head_seq + 1);
+    }
+
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, head_sector * TELEMETRY_SECTOR_SIZE + head_slot * sizeof(slot), &slot, sizeof(slot));
+    }
+    if (err == ESP_OK)
+    {
+        head_slot++;
+    }
+    xSemaphoreGive(telemetry_mutex);
+
+    return err;
+}
+
+esp_err_t telemetry_flush()
+{
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Each batch is copied out under the mutex and uploaded without it, so a button press during the sync records
+    // straight away.  Records added meanwhile go out in a later batch or on the next sync.
+    esp_err_t err = ESP_OK;
+    int uploaded = 0;
+    do
+    {
+        upload.count = 0;
+        xSemaphoreTake(telemetry_mutex, portMAX_DELAY);
+        for_each_record(collect_record, &upload);
+        xSemaphoreGive(telemetry_mutex);
+        if (upload.count == 0)
+        {
+            break;
+        }
+
+        err = upload_batch(&upload);
+        if (err == ESP_OK)
+        {
+            xSemaphoreTake(telemetry_mutex, portMAX_DELAY);
+            err = consume_batch(&upload);
+            xSemaphoreGive(telemetry_mutex);
+            uploaded += upload.count;
+        }
+    } while (err == ESP_OK && upload.count == UPLOAD_BATCH_SLOTS);
+
+    if (uploaded > 0)
+    {
+        ESP_LOGI(TAG, "Uploaded %d events", uploaded);
+    }
+
+    return err;
+}
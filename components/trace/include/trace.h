@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+#define TRACE_RING_SIZE (1 << CONFIG_TRACE_RING_ORDER)
+
+typedef enum {
+    TRACE_EVT_STEP = 1,
+    TRACE_EVT_BUTTON_ISR,
+    TRACE_EVT_KEYFRAME,
+    TRACE_EVT_SLEEP_ENTER,
+    TRACE_EVT_SLEEP_EXIT,
+    TRACE_EVT_WIFI,
+    TRACE_EVT_TIME,     // esp_timer time of the entry before it: low 32 bits of us in cycles, next 16 in arg
+} trace_event_t;
+
+typedef struct {
+    uint32_t cycles;
+    uint16_t arg;
+    uint8_t event;
+    uint8_t core;
+} trace_entry_t;
+
+extern trace_entry_t trace_ring[TRACE_RING_SIZE];
+extern uint32_t trace_ring_head;
+
+// Entries are timed in CPU cycles, converted at the maximum CPU frequency.  Only record plain entries while that
+// holds, as the motor and buzzer PM locks do with tracing on; anywhere else use trace_record_timed().
+// Safe from ISRs and either core.  The slot is claimed with one atomic add, so concurrent writers never share an entry.
+FORCE_INLINE_ATTR void trace_record(trace_event_t event, uint16_t arg)
+{
+#if CONFIG_TRACE_ENABLE
+    trace_entry_t *entry = &trace_ring[__atomic_fetch_add(&trace_ring_head, 1, __ATOMIC_RELAXED) & (TRACE_RING_SIZE - 1)];
+    entry->cycles = esp_cpu_get_cycle_count();
+    entry->arg = arg;
+    entry->event = event;
+    entry->core = esp_cpu_get_core_id();
+#endif
+}
+
+// As trace_record(), followed by a TRACE_EVT_TIME entry.  The cycle counter wraps, stops in light sleep and slows
+// down with frequency scaling, so use this for events that can come after a long gap or at a lower frequency; the
+// decoder re-anchors on them.
+FORCE_INLINE_ATTR void trace_record_timed(trace_event_t event, uint16_t arg)
+{
+#if CONFIG_TRACE_ENABLE
+    uint32_t idx = __atomic_fetch_add(&trace_ring_head, 2, __ATOMIC_RELAXED);
+    trace_entry_t *entry = &trace_ring[idx & (TRACE_RING_SIZE - 1)];
+    trace_entry_t *time_entry = &trace_ring[(idx + 1) & (TRACE_RING_SIZE - 1)];
+    uint64_t now_us = esp_timer_get_time();
+    entry->cycles = esp_cpu_get_cycle_count();
+    entry->arg = arg;
+    entry->event = event;
+    entry->core = esp_cpu_get_core_id();
+    time_entry->cycles = (uint32_t)now_us;
+    time_entry->arg = (uint16_t)(now_us >> 32);
+    time_entry->event = TRACE_EVT_TIME;
+    time_entry->core = entry->core;
+#endif
+}
+
+// Print the ring to the console as hex lines for tools/trace_decode.py.
+void trace_dump();
+
+// Adds the `trace` console command, which runs trace_dump().
+esp_err_t trace_register_commands();
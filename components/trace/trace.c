@@ -0,0 +1,55 @@
+#include "trace.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_console.h"
+
+#define DUMP_ENTRIES_PER_LINE 8
+
+trace_entry_t trace_ring[TRACE_RING_SIZE];
+uint32_t trace_ring_head = 0;
+
+void trace_dump()
+{
+    uint32_t head = __atomic_load_n(&trace_ring_head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+    // Untimed entries are only recorded while a PM lock holds the CPU at its maximum frequency, see trace.h.
+    printf("TRACE BEGIN %d %" PRIu32 "\n", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, count);
+
+    // Entries may still be written while dumping; the oldest few can be overwritten mid-dump.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *bytes = (const uint8_t *)&trace_ring[(head - count + i) & (TRACE_RING_SIZE - 1)];
+        if (i % DUMP_ENTRIES_PER_LINE == 0)
+        {
+            printf("TRACE ");
+        }
+
+        for (int b = 0; b < sizeof(trace_entry_t); b++)
+        {
+            printf("%02x", bytes[b]);
+        }
+
+        printf(i % DUMP_ENTRIES_PER_LINE == DUMP_ENTRIES_PER_LINE - 1 || i == count - 1 ? "\n" : " ");
+    }
+
+    printf("TRACE END\n");
+}
+
+static int trace_command(int argc, char **argv)
+{
+    trace_dump();
+
+    return 0;
+}
+
+esp_err_t trace_register_commands()
+{
+    const esp_console_cmd_t command = {
+        .command = "trace",
+        .help = "Print the trace ring for tools/trace_decode.py",
+        .func = &trace_command,
+    };
+
+    return esp_console_cmd_register(&command);
+}
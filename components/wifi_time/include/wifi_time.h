@@ -1,4 +1,16 @@
 #pragma once
 #include "esp_err.h"
+#include <stdbool.h>
+
+typedef esp_err_t (*wifi_time_online_cb_t)();
 
 esp_err_t blocking_update_time();
+
+// Register a callback run while WiFi is up after a successful time sync.
+esp_err_t wifi_time_register_online_cb(wifi_time_online_cb_t cb);
+
+// True from WiFi start until it is stopped again.
+bool wifi_time_is_active();
+
+// Adds the `netstats` console command.
+esp_err_t wifi_time_register_commands();
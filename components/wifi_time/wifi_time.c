@@ -1,5 +1,7 @@
 #include "wifi_time.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -7,13 +9,20 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
 #include "esp_sntp.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "trace.h"
+#include "energy.h"
+#include "feeder_config.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
 static EventGroupHandle_t s_wifi_event_group;
+static StaticEventGroup_t s_wifi_event_group_buffer;
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
 #define WIFI_DISCONNECTED_BIT BIT2
@@ -23,21 +32,42 @@ static EventGroupHandle_t s_wifi_event_group;
 #define TIME_UPDATE_SUCCESS_BIT BIT6
 #define LAST_EVENT_BIT BIT6
 
+#define TRACE_WIFI_IP_EVENT_FLAG 0x100
+
 #define WIFI_RETRIES 10
 #define SNTP_RETRIES 10
+#define MAX_ONLINE_CBS 4
+#define SNTP_POLL_MS 2000
+#define LATENCY_SAMPLES 32
 
 #define ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_WPA_WPA2_PSK
 #define ESP_WIFI_SAE_MODE WPA3_SAE_PWE_BOTH
 
 static const char *TAG = "WIFI_TIME";
 
+// The latest successful timings in a ring, plus counts of every attempt.
+typedef struct {
+    uint32_t samples_ms[LATENCY_SAMPLES];
+    uint32_t successes;
+    uint32_t failures;
+} latency_log_t;
+
 static esp_event_handler_instance_t instance_any_id;
 static esp_event_handler_instance_t instance_got_ip;
 static esp_netif_t *netif_handle;
 static int s_retry_num = 0;
+static esp_pm_lock_handle_t wifi_pm_lock;
+static volatile bool wifi_active = false;
+static wifi_time_online_cb_t online_cbs[MAX_ONLINE_CBS];
+static int online_cb_count = 0;
+// Kept in RTC memory so syncs from separate deep sleep wakes add up.
+static RTC_DATA_ATTR latency_log_t connect_latency;
+static RTC_DATA_ATTR latency_log_t sntp_latency;
 
 static void my_wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
+    trace_record_timed(TRACE_EVT_WIFI, (event_base == IP_EVENT ? TRACE_WIFI_IP_EVENT_FLAG : 0) | event_id);
+
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
         esp_wifi_connect();
@@ -65,15 +95,21 @@ static void my_wifi_event_handler(void *arg, esp_event_base_t event_base, int32_
     }
 }
 
-static void init_nvs()
+static void record_latency(latency_log_t *log, int64_t start_us, bool success)
 {
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    if (success)
     {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+        log->samples_ms[log->successes++ % LATENCY_SAMPLES] = (esp_timer_get_time() - start_us) / 1000;
+    }
+    else
+    {
+        log->failures++;
     }
-    ESP_ERROR_CHECK(ret);
+}
+
+static void on_time_sync(struct timeval *tv)
+{
+    xEventGroupSetBits(s_wifi_event_group, SNTP_SUCCESS_BIT);
 }
 
 static void config_sntp()
@@ -82,19 +118,20 @@ static void config_sntp()
     esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
     esp_sntp_setservername(0, "pool.ntp.org");
     esp_sntp_set_sync_mode(SNTP_SYNC_MODE_IMMED);
-    setenv("TZ", CONFIG_TIMEZONE, 1);
-    tzset();
+    sntp_set_time_sync_notification_cb(on_time_sync);
 }
 
 static void init_wifi()
 {
-    s_wifi_event_group = xEventGroupCreate();
+    s_wifi_event_group = xEventGroupCreateStatic(&s_wifi_event_group_buffer);
 
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_sta();
 
+    // A fast wake from deep sleep leaves NVS alone at boot, and the driver keeps its calibration data there.
+    ESP_ERROR_CHECK(feeder_config_ensure_nvs());
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
@@ -112,10 +149,15 @@ static void init_wifi()
                                                         NULL,
                                                         &instance_got_ip));
 
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+}
+
+// Set before every connect, so credentials changed through feeder_config apply from the next sync.
+static void apply_wifi_config()
+{
+    const feeder_config_t *config = feeder_config_get();
     wifi_config_t wifi_config = {
         .sta = {
-            .ssid = CONFIG_WIFI_SSID,
-            .password = CONFIG_WIFI_PASSWORD,
             /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
              * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
              * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
@@ -123,35 +165,56 @@ static void init_wifi()
              */
             .threshold.authmode = WIFI_AUTH_WPA2_PSK},
     };
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    // Both fit without a terminator, as the WiFi driver allows.
+    memcpy(wifi_config.sta.ssid, config->wifi_ssid, strlen(config->wifi_ssid));
+    memcpy(wifi_config.sta.password, config->wifi_password, strlen(config->wifi_password));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
 }
 
+static void stop_wifi()
+{
+    esp_wifi_stop();
+    wifi_active = false;
+    energy_end(ENERGY_STATE_RADIO);
+    esp_pm_lock_release(wifi_pm_lock);
+}
+
 esp_err_t blocking_update_time()
 {
     if (s_wifi_event_group == NULL)
     {
-        init_nvs();
         init_wifi();
         ESP_LOGI(TAG, "wifi_init_sta finished.");
 
         config_sntp();
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "wifi_time", &wifi_pm_lock);
     }
 
+    // Full speed and no light sleep keeps the radio-on window as short as possible.
+    esp_pm_lock_acquire(wifi_pm_lock);
+    energy_begin(ENERGY_STATE_RADIO);
+    wifi_active = true;
+    apply_wifi_config();
+    // Left over from the previous sync, they would end the waits below straight away.
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | SNTP_SUCCESS_BIT);
+    s_retry_num = 0;
+    int64_t start_us = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_wifi_start());
     EventBits_t result = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    record_latency(&connect_latency, start_us, result & WIFI_CONNECTED_BIT);
 
     while(1) {
         if (result & WIFI_CONNECTED_BIT)
         {
             ESP_LOGI(TAG, "connected to ap SSID:%s",
-                    CONFIG_WIFI_SSID);
+                    feeder_config_get()->wifi_ssid);
             break;
         }
         else if (result & WIFI_FAIL_BIT)
         {
             ESP_LOGI(TAG, "Failed to connect to SSID:%s",
-                    CONFIG_WIFI_SSID);
+                    feeder_config_get()->wifi_ssid);
+            stop_wifi();
             return ESP_FAIL;
         }
         else
@@ -160,20 +223,90 @@ esp_err_t blocking_update_time()
         }
     }
 
+    start_us = esp_timer_get_time();
     esp_sntp_init();
     int retry_count = 0;
-    while (esp_sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET || esp_sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED)
+    while (!(xEventGroupWaitBits(s_wifi_event_group, SNTP_SUCCESS_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(SNTP_POLL_MS)) & SNTP_SUCCESS_BIT))
     {
         ESP_LOGI(TAG, "Waiting for system time to be set");
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
         if (retry_count++ > SNTP_RETRIES)
         {
             ESP_LOGE(TAG, "failed to get sntp time update!");
+            record_latency(&sntp_latency, start_us, false);
+            esp_sntp_stop();
+            stop_wifi();
             return ESP_FAIL;
         }
     }
+    record_latency(&sntp_latency, start_us, true);
     esp_sntp_stop();
-    esp_wifi_stop();
+
+    for (int i = 0; i < online_cb_count; i++)
+    {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(online_cbs[i]());
+    }
+
+    stop_wifi();
+
+    return ESP_OK;
+}
+
+esp_err_t wifi_time_register_online_cb(wifi_time_online_cb_t cb)
+{
+    if (online_cb_count == MAX_ONLINE_CBS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    online_cbs[online_cb_count++] = cb;
 
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+bool wifi_time_is_active()
+{
+    return wifi_active;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentiles over the samples still in the ring.
+static void print_latency(const char *label, const latency_log_t *log)
+{
+    uint32_t sorted[LATENCY_SAMPLES];
+    int count = log->successes < LATENCY_SAMPLES ? log->successes : LATENCY_SAMPLES;
+    printf("%-8s ok %lu  failed %lu", label, log->successes, log->failures);
+    if (count > 0)
+    {
+        memcpy(sorted, log->samples_ms, count * sizeof(sorted[0]));
+        qsort(sorted, count, sizeof(sorted[0]), compare_u32);
+        printf("  last %d: p50 %lu ms  p90 %lu ms  max %lu ms", count, sorted[(count - 1) / 2], sorted[(count * 9 + 9) / 10 - 1],
+               sorted[count - 1]);
+    }
+    printf("\n");
+}
+
+static int netstats_command(int argc, char **argv)
+{
+    print_latency("connect", &connect_latency);
+    print_latency("sntp", &sntp_latency);
+
+    return 0;
+}
+
+esp_err_t wifi_time_register_commands()
+{
+    const esp_console_cmd_t command = {
+        .command = "netstats",
+        .help = "WiFi connect and SNTP sync latency percentiles",
+        .func = &netstats_command,
+    };
+
+    return esp_console_cmd_register(&command);
+}
@@ -0,0 +1,210 @@
+// Drives the real feeder_motion.c against the mock coil HAL and reports step timing and coil state validity.
+//   feeder_bench [--realtime] [--latency-us N] [--verbose]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "feeder_motion.h"
+#include "feeder_hal.h"
+#include "mock_hal.h"
+#include "sdkconfig.h"
+
+// Physical position at which the limit switch closes during callibration.
+#define LIMIT_POSITION 0
+// Default worst case wake latency in virtual time, about what a busy FreeRTOS core adds.
+#define DEFAULT_LATENCY_US 200
+// Late wakeups must not add up: the mean period may drift by at most this fraction of the nominal one.
+#define MAX_MEAN_DRIFT 0.01
+
+typedef bool (*move_queue_fn_t)();
+
+typedef struct {
+    int moves;
+    int steps;
+    double period_mean_us;
+    double period_stddev_us;
+    double period_max_dev_us;
+    double moves_per_sec;
+} move_stats_t;
+
+static bool verbose = false;
+// Negative in realtime mode, where the host decides the latency and timing is only reported.
+static int latency_us = DEFAULT_LATENCY_US;
+
+// Same loop shape as target_step_task: step, check the limit switch, wait for the next period, then hold.
+static int run_move()
+{
+    int steps = 0;
+    int64_t next_step_us = mock_hal_time_us();
+
+    while (feeder_motion_step())
+    {
+        steps++;
+        if (feeder_motion_is_callibrating() && mock_hal_log()->physical_position <= LIMIT_POSITION)
+        {
+            feeder_motion_limit_reached();
+        }
+
+        next_step_us += FEEDER_STEP_PERIOD_US;
+        mock_hal_sleep_until(next_step_us);
+    }
+#if defined(CONFIG_MOTOR_DRIVE_PWM) && CONFIG_MOTOR_PWM_HOLD_MS > 0
+    feeder_hal_set_duty(CONFIG_MOTOR_PWM_HOLD_DUTY * 10);
+    mock_hal_sleep_until(next_step_us + CONFIG_MOTOR_PWM_HOLD_MS * 1000);
+#endif
+    feeder_hal_set_coils(0);
+
+    return steps;
+}
+
+static void analyze_periods(const mock_coil_log_t *log, move_stats_t *stats)
+{
+    double sum = 0;
+    double sq_sum = 0;
+    int count = 0;
+    int64_t last_us = -1;
+
+    stats->period_max_dev_us = 0;
+    for (int i = 0; i < log->transition_count; i++)
+    {
+        if (log->transitions[i].coils == 0)
+        {
+            last_us = -1;
+            continue;
+        }
+
+        if (last_us >= 0)
+        {
+            double period = log->transitions[i].time_us - last_us;
+            double dev = fabs(period - FEEDER_STEP_PERIOD_US);
+            sum += period;
+            sq_sum += period * period;
+            count++;
+            if (dev > stats->period_max_dev_us)
+            {
+                stats->period_max_dev_us = dev;
+            }
+        }
+        last_us = log->transitions[i].time_us;
+    }
+
+    stats->period_mean_us = count > 0 ? sum / count : 0;
+    stats->period_stddev_us = count > 1 ? sqrt(fmax(0, sq_sum / count - stats->period_mean_us * stats->period_mean_us)) : 0;
+}
+
+static bool run_scenario(const char *name, move_queue_fn_t queue_move, int expected_position)
+{
+    move_stats_t stats = {0};
+    mock_hal_clear_log();
+
+    int64_t start_us = mock_hal_time_us();
+    while (queue_move())
+    {
+        stats.moves++;
+        stats.steps += run_move();
+    }
+    int64_t elapsed_us = mock_hal_time_us() - start_us;
+
+    const mock_coil_log_t *log = mock_hal_log();
+    analyze_periods(log, &stats);
+    stats.moves_per_sec = elapsed_us > 0 ? stats.moves * 1e6 / elapsed_us : 0;
+
+    int position_error = feeder_motion_position() - log->physical_position;
+    bool ok = log->invalid_states == 0 && position_error == 0 && feeder_motion_position() == expected_position;
+    if (latency_us >= 0)
+    {
+        // Each period can only be off by one late wakeup; any more means the deadlines drift.
+        ok &= fabs(stats.period_mean_us - FEEDER_STEP_PERIOD_US) <= FEEDER_STEP_PERIOD_US * MAX_MEAN_DRIFT &&
+              stats.period_max_dev_us <= latency_us;
+    }
+
+    // Drive time against every step at full duty, the plain GPIO drive.
+    printf("%-14s moves=%-3d steps=%-5d period mean=%.1fus stddev=%.1fus max_dev=%.1fus invalid=%d pos=%d/%d drive=%lldms/%lldms moves/s=%.2f %s\n",
+           name, stats.moves, stats.steps, stats.period_mean_us, stats.period_stddev_us, stats.period_max_dev_us,
+           log->invalid_states, feeder_motion_position(), log->physical_position, (long long)log->drive_us / 1000,
+           (long long)stats.steps * FEEDER_STEP_PERIOD_US / 1000, stats.moves_per_sec, ok ? "OK" : "FAIL");
+    if (verbose)
+    {
+        for (int i = 0; i < log->transition_count; i++)
+        {
+            printf("  %10lld us  coils %x\n", (long long)log->transitions[i].time_us, log->transitions[i].coils);
+        }
+    }
+
+    return ok;
+}
+
+static bool queue_extend()
+{
+    return feeder_motion_extend_bucket();
+}
+
+static bool queue_eject_once()
+{
+    static bool queued = false;
+    if (queued)
+    {
+        return false;
+    }
+
+    queued = true;
+    return feeder_motion_eject_buckets();
+}
+
+static bool queue_callibration_once()
+{
+    static bool queued = false;
+    if (queued)
+    {
+        return false;
+    }
+
+    queued = true;
+    feeder_motion_start_callibration();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool realtime = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)
+        {
+            realtime = true;
+        }
+        else if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc)
+        {
+            latency_us = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--realtime] [--latency-us N] [--verbose]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    mock_hal_reset(realtime);
+    if (realtime)
+    {
+        latency_us = -1;
+        printf("real time, %dus step period\n", FEEDER_STEP_PERIOD_US);
+    }
+    else
+    {
+        mock_hal_set_wake_latency(latency_us);
+        printf("virtual time, %dus step period, wakeups up to %dus late\n", FEEDER_STEP_PERIOD_US, latency_us);
+    }
+
+    int full_position = CONFIG_FIRST_BUCKET_STEPS + (CONFIG_BUCKET_COUNT - 1) * CONFIG_STEPS_PER_BUCKET;
+    bool ok = run_scenario("extend_bucket", queue_extend, full_position);
+    ok &= run_scenario("eject_buckets", queue_eject_once, full_position + CONFIG_STEPS_PER_BUCKET * 3);
+    ok &= run_scenario("callibration", queue_callibration_once, LIMIT_POSITION);
+
+    return ok ? 0 : 1;
+}
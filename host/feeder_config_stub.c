@@ -0,0 +1,32 @@
+#include "feeder_config.h"
+#include <stdlib.h>
+#include <time.h>
+#include "sdkconfig.h"
+
+// Host stand-in for the NVS backed store: the Kconfig defaults from include/sdkconfig.h, which sim_year overrides
+// from its command line before booting.
+feeder_config_t host_config = {
+    .version = FEEDER_CONFIG_VERSION,
+    .feeding_time = CONFIG_FEEDING_TIME,
+    .steps_per_bucket = CONFIG_STEPS_PER_BUCKET,
+    .first_bucket_steps = CONFIG_FIRST_BUCKET_STEPS,
+    .bucket_count = CONFIG_BUCKET_COUNT,
+    .timezone = CONFIG_TIMEZONE,
+};
+
+const feeder_config_t *feeder_config_get()
+{
+    return &host_config;
+}
+
+// Settings never change on the host.
+esp_err_t feeder_config_register_change_cb(feeder_config_change_cb_t cb)
+{
+    return ESP_OK;
+}
+
+void feeder_config_apply_timezone()
+{
+    setenv("TZ", host_config.timezone, 1);
+    tzset();
+}
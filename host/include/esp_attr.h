@@ -0,0 +1,5 @@
+#pragma once
+
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
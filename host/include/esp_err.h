@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_SIZE 0x104
+
+// Same as the IDF macro: report a failed call and carry on.
+#define ESP_ERROR_CHECK_WITHOUT_ABORT(x) ({                                   \
+        esp_err_t err_rc_ = (x);                                                  \
+        if (err_rc_ != ESP_OK) {                                                  \
+            fprintf(stderr, "%s failed: %d at %s:%d\n", #x, err_rc_, __FILE__, __LINE__); \
+        }                                                                         \
+        err_rc_;                                                                  \
+    })
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// sim_year runs the one task it is given on its own stack once the creating call returns.
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer,
+                                           BaseType_t core);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+void vTaskDelete(TaskHandle_t task);
@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stand-in for the generated sdkconfig.h, using the defaults from main/Kconfig.projbuild.
+
+#define CONFIG_STEP1_GPIO 33
+#define CONFIG_STEP2_GPIO 25
+#define CONFIG_STEP3_GPIO 27
+#define CONFIG_STEP4_GPIO 14
+#define CONFIG_EXTEND_BTN_GPIO 15
+#define CONFIG_RETRACT_BTN_GPIO 32
+#define CONFIG_LIMIT_GPIO 12
+#define CONFIG_TIMEZONE "MST7MDT,M3.2.0/2,M11.1.0"
+#define CONFIG_EXTEND_BUTTON_ACTIVE 1
+#define CONFIG_STEPS_PER_BUCKET 340
+#define CONFIG_FIRST_BUCKET_STEPS 420
+#define CONFIG_BUCKET_COUNT 10
+#define CONFIG_FEEDING_TIME 900
+#define CONFIG_DEEP_SLEEP_IDLE_SECS 10
+#define CONFIG_NETWORK_TASK_CORE 0
+#define CONFIG_SCHEDULER_TASK_PRIORITY 5
+#define CONFIG_TRACE_RING_ORDER 9
+
+// Not a Kconfig default, but on here so feeder_bench covers the PWM drive profile.
+#define CONFIG_MOTOR_DRIVE_PWM 1
+#define CONFIG_MOTOR_PWM_FREQ_HZ 20000
+#define CONFIG_MOTOR_PWM_ACCEL_STEPS 32
+#define CONFIG_MOTOR_PWM_CRUISE_DUTY 70
+#define CONFIG_MOTOR_PWM_HOLD_DUTY 20
+#define CONFIG_MOTOR_PWM_HOLD_MS 500
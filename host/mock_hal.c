@@ -0,0 +1,194 @@
+#include "mock_hal.h"
+#include <stdlib.h>
+#include <time.h>
+#include "feeder_hal.h"
+
+#define PHASE_COUNT 4
+#define NO_PHASE -1
+
+// Order the rotor follows when stepping forward.  This is the motor's truth, independent of feeder_motion.c.
+static const uint8_t PHASES[PHASE_COUNT] = {FEEDER_COIL_4, FEEDER_COIL_3, FEEDER_COIL_2, FEEDER_COIL_1};
+
+static bool realtime_mode;
+static bool held;
+static int64_t virtual_time_us;
+static int wake_latency_max_us;
+static uint32_t latency_seed;
+static int last_phase;
+static uint8_t energized_coils;
+static uint16_t drive_duty;
+static int64_t drive_since_us;
+static int transition_capacity;
+static mock_coil_log_t coil_log;
+
+static int phase_of(uint8_t coils)
+{
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        if (PHASES[i] == coils)
+        {
+            return i;
+        }
+    }
+
+    return NO_PHASE;
+}
+
+void mock_hal_reset(bool realtime)
+{
+    realtime_mode = realtime;
+    virtual_time_us = 0;
+    wake_latency_max_us = 0;
+    latency_seed = 1;
+    // The rotor rests on the phase feeder_motion.c starts its sequence from.
+    last_phase = 0;
+    held = false;
+    energized_coils = 0;
+    drive_duty = FEEDER_DUTY_FULL;
+    coil_log.physical_position = 0;
+    mock_hal_clear_log();
+}
+
+void mock_hal_set_wake_latency(int max_us)
+{
+    wake_latency_max_us = max_us;
+}
+
+// xorshift32, so runs are repeatable.
+static int next_wake_latency_us()
+{
+    if (wake_latency_max_us == 0)
+    {
+        return 0;
+    }
+
+    latency_seed ^= latency_seed << 13;
+    latency_seed ^= latency_seed >> 17;
+    latency_seed ^= latency_seed << 5;
+
+    return latency_seed % (wake_latency_max_us + 1);
+}
+
+void mock_hal_clear_log()
+{
+    coil_log.transition_count = 0;
+    coil_log.invalid_states = 0;
+    coil_log.drive_us = 0;
+    drive_since_us = mock_hal_time_us();
+}
+
+static void accumulate_drive()
+{
+    int64_t now_us = mock_hal_time_us();
+    if (energized_coils != 0)
+    {
+        coil_log.drive_us += (now_us - drive_since_us) * drive_duty / FEEDER_DUTY_FULL;
+    }
+    drive_since_us = now_us;
+}
+
+const mock_coil_log_t *mock_hal_log()
+{
+    return &coil_log;
+}
+
+int64_t mock_hal_time_us()
+{
+    if (!realtime_mode)
+    {
+        return virtual_time_us;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void mock_hal_sleep_until(int64_t time_us)
+{
+    if (!realtime_mode)
+    {
+        if (time_us > virtual_time_us)
+        {
+            virtual_time_us = time_us;
+        }
+        virtual_time_us += next_wake_latency_us();
+        return;
+    }
+
+    struct timespec deadline = {
+        .tv_sec = time_us / 1000000,
+        .tv_nsec = (time_us % 1000000) * 1000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+    {
+    }
+}
+
+esp_err_t feeder_hal_init()
+{
+    return ESP_OK;
+}
+
+void feeder_hal_set_coils(uint8_t coil_mask)
+{
+    if (coil_log.transition_count == transition_capacity)
+    {
+        transition_capacity = transition_capacity == 0 ? 1024 : transition_capacity * 2;
+        coil_log.transitions = realloc(coil_log.transitions, transition_capacity * sizeof(mock_transition_t));
+    }
+    coil_log.transitions[coil_log.transition_count++] = (mock_transition_t){
+        .time_us = mock_hal_time_us(),
+        .coils = coil_mask,
+    };
+
+    if (held)
+    {
+        coil_log.invalid_states++;
+        return;
+    }
+
+    accumulate_drive();
+    energized_coils = coil_mask;
+    if (coil_mask == 0)
+    {
+        return;
+    }
+
+    int phase = phase_of(coil_mask);
+    if (phase == NO_PHASE)
+    {
+        coil_log.invalid_states++;
+        return;
+    }
+
+    if (last_phase != NO_PHASE)
+    {
+        int delta = (phase - last_phase + PHASE_COUNT) % PHASE_COUNT;
+        if (delta == 1)
+        {
+            coil_log.physical_position++;
+        }
+        else if (delta == PHASE_COUNT - 1)
+        {
+            coil_log.physical_position--;
+        }
+        else if (delta != 0)
+        {
+            coil_log.invalid_states++;
+        }
+    }
+    last_phase = phase;
+}
+
+void feeder_hal_set_duty(uint16_t duty_permille)
+{
+    accumulate_drive();
+    drive_duty = duty_permille;
+}
+
+void feeder_hal_hold(bool hold)
+{
+    held = hold;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int64_t time_us;
+    uint8_t coils;
+} mock_transition_t;
+
+typedef struct {
+    mock_transition_t *transitions;
+    int transition_count;
+    // A state with other than a single coil energized, a phase change that is not to a neighbouring phase, or a
+    // write while the outputs are held.
+    int invalid_states;
+    // Rotor position in steps, integrated from the energized phases.
+    int physical_position;
+    // Coil on time weighted by PWM duty, as if driven at full duty.
+    int64_t drive_us;
+} mock_coil_log_t;
+
+// Realtime mode timestamps with the monotonic clock and really sleeps, otherwise time is virtual.
+void mock_hal_reset(bool realtime);
+
+// In virtual time, each sleep wakes up late by a pseudo random 0..max_us, standing in for scheduling latency.
+void mock_hal_set_wake_latency(int max_us);
+
+void mock_hal_clear_log();
+
+const mock_coil_log_t *mock_hal_log();
+
+int64_t mock_hal_time_us();
+
+void mock_hal_sleep_until(int64_t time_us);
@@ -0,0 +1,82 @@
+#include "telemetry.h"
+#include "trace.h"
+#include "energy.h"
+#include "buzzer_control.h"
+#include "boot_stages.h"
+#include "diagnostics.h"
+
+// No-op stand-ins for the components scheduler.c reports to but whose effects sim_year does not check.
+
+esp_err_t telemetry_record(telemetry_event_t event, uint16_t arg)
+{
+    return ESP_OK;
+}
+
+void trace_dump()
+{
+}
+
+void energy_prepare_deep_sleep()
+{
+}
+
+void energy_begin(energy_state_t state)
+{
+}
+
+void energy_end(energy_state_t state)
+{
+}
+
+void energy_log_stats()
+{
+}
+
+esp_err_t buzzer_control_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t buzzer_control_play_pattern(buzzer_pattern_t *pattern)
+{
+    return ESP_OK;
+}
+
+bool buzzer_control_is_playing()
+{
+    return false;
+}
+
+void boot_stage_begin(boot_stage_t stage)
+{
+}
+
+void boot_stage_done(boot_stage_t stage, bool ok)
+{
+}
+
+void boot_stage_skip(boot_stage_t stage)
+{
+}
+
+bool boot_stages_wait(EventBits_t bits, TickType_t timeout)
+{
+    return true;
+}
+
+bool boot_stage_ok(boot_stage_t stage)
+{
+    return true;
+}
+
+void diagnostics_mark_boot()
+{
+}
+
+void diagnostics_log_tasks()
+{
+}
+
+void diagnostics_record_wakeup(esp_sleep_wakeup_cause_t cause, bool deep)
+{
+}
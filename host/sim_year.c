@@ -0,0 +1,509 @@
+// Runs the real scheduler loop (scheduler.c and sched_core.c) and feeder logic against a virtual clock and a fake
+// SNTP source, jumping straight from one wakeup to the next, and checks that every local calendar day, by the
+// device's clock, gets exactly one feeding.  The FreeRTOS, sleep and clock calls the loop makes land in the shims
+// below; a deep sleep jumps back here and boots the scheduler again, with only its RTC memory kept.
+//   sim_year [--days N] [--feeding-time HHMM] [--start YYYY-MM-DD] [--drift-ppm N] [--fail-every N] [--tz POSIX_TZ] [--deep-sleep] [--verbose]
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "scheduler.h"
+#include "wifi_time.h"
+#include "feeder_control.h"
+#include "feeder_config.h"
+#include "feeder_motion.h"
+#include "feeder_hal.h"
+#include "mock_hal.h"
+#include "sdkconfig.h"
+
+#define US_PER_SEC 1000000LL
+#define SYNC_DURATION_US (4 * US_PER_SEC)
+// Time the scheduler loop spends awake per tick before it sleeps again, on top of the requested sleep.  Also the
+// time from a deep sleep wakeup to the loop starting again.
+#define MAX_TICK_OVERHEAD_US (1500 * 1000LL)
+
+typedef struct {
+    int days;
+    int feeding_time;
+    time_t start;
+    int drift_ppm;
+    int fail_every;
+    bool deep_sleep;
+    bool verbose;
+} sim_options_t;
+
+typedef struct {
+    int64_t true_us;        // real UTC, microseconds since the epoch
+    int64_t uptime_us;      // what esp_timer_get_time() would return
+    int64_t clock_error_us; // device clock minus real time
+    bool clock_set;
+    uint32_t rng;
+} sim_clock_t;
+
+typedef struct {
+    int feeds;
+    int syncs;
+    int failed_syncs;
+    int refills;
+    int invalid_coil_states;
+    int dst_changes;
+    int deep_sleeps;
+    int64_t max_offset_us;
+    long ticks;
+    int last_isdst;
+    int *feeds_per_day;
+} sim_results_t;
+
+// The same scheduler.c built with CONFIG_DEEP_SLEEP_ACTIVE, see CMakeLists.txt.
+esp_err_t scheduler_start_deep_sleep();
+
+// feeder_config_stub.c
+extern feeder_config_t host_config;
+
+static sim_options_t options;
+static sim_results_t results;
+static sim_clock_t clock_state;
+static time_t end;
+static bool finished;
+// Where a deep sleep or the end of the run jumps back to.
+static jmp_buf power_cycle;
+static TaskFunction_t loop_task;
+static esp_reset_reason_t reset_reason;
+static uint64_t timer_wakeup_us;
+static int64_t last_move_us;
+
+static uint32_t next_random()
+{
+    clock_state.rng = clock_state.rng * 1664525 + 1013904223;
+    return clock_state.rng >> 8;
+}
+
+static time_t device_time()
+{
+    if (!clock_state.clock_set)
+    {
+        // Unsynced RTC counts up from the epoch.
+        return clock_state.uptime_us / US_PER_SEC;
+    }
+
+    return (clock_state.true_us + clock_state.clock_error_us) / US_PER_SEC;
+}
+
+static void advance(int64_t us)
+{
+    clock_state.true_us += us;
+    clock_state.uptime_us += us;
+    clock_state.clock_error_us += us * options.drift_ppm / 1000000;
+}
+
+// Counts a wakeup of the loop and ends the run once the virtual clock has passed the end.
+static void wake()
+{
+    results.ticks++;
+
+    time_t true_now = clock_state.true_us / US_PER_SEC;
+    struct tm local;
+    localtime_r(&true_now, &local);
+    if (results.last_isdst >= 0 && local.tm_isdst != results.last_isdst)
+    {
+        results.dst_changes++;
+    }
+    results.last_isdst = local.tm_isdst;
+
+    if (true_now >= end)
+    {
+        finished = true;
+        longjmp(power_cycle, 1);
+    }
+}
+
+// Every fail_every'th attempt fails to connect.
+esp_err_t blocking_update_time()
+{
+    advance(SYNC_DURATION_US);
+    results.syncs++;
+    if (options.fail_every > 0 && results.syncs % options.fail_every == 0)
+    {
+        results.failed_syncs++;
+        return ESP_FAIL;
+    }
+
+    clock_state.clock_set = true;
+    clock_state.clock_error_us = 0;
+
+    return ESP_OK;
+}
+
+time_t sim_time(time_t *t)
+{
+    time_t now = device_time();
+    if (t != NULL)
+    {
+        *t = now;
+    }
+
+    return now;
+}
+
+int64_t esp_timer_get_time()
+{
+    return clock_state.uptime_us;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer,
+                                           BaseType_t core)
+{
+    loop_task = fn;
+
+    return &loop_task;
+}
+
+// Nothing else runs, so a notification never comes and every wait runs its full timeout.
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    advance((int64_t)ticks_to_wait * 1000 + next_random() % MAX_TICK_OVERHEAD_US);
+    wake();
+
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdTRUE;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    advance((int64_t)ticks * 1000);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+esp_reset_reason_t esp_reset_reason()
+{
+    return reset_reason;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return reset_reason == ESP_RST_DEEPSLEEP ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    timer_wakeup_us = time_in_us;
+
+    return ESP_OK;
+}
+
+// RAM and the uptime counter are lost; only RTC memory and the RTC clock carry over.
+void esp_deep_sleep_start()
+{
+    advance(timer_wakeup_us);
+    clock_state.uptime_us = 0;
+    advance(next_random() % MAX_TICK_OVERHEAD_US);
+    reset_reason = ESP_RST_DEEPSLEEP;
+    results.deep_sleeps++;
+    wake();
+    longjmp(power_cycle, 1);
+}
+
+static void run_move()
+{
+    while (feeder_motion_step())
+    {
+        if (feeder_motion_is_callibrating() && mock_hal_log()->physical_position <= 0)
+        {
+            feeder_motion_limit_reached();
+        }
+    }
+    feeder_hal_set_coils(0);
+}
+
+static void feed()
+{
+    if (feeder_motion_all_buckets_extended())
+    {
+        // Someone empties and reloads the feeder.
+        feeder_motion_eject_buckets();
+        run_move();
+        feeder_motion_start_callibration();
+        run_move();
+        results.refills++;
+    }
+
+    feeder_motion_extend_bucket();
+    run_move();
+    results.invalid_coil_states += mock_hal_log()->invalid_states;
+    mock_hal_clear_log();
+}
+
+static int day_index(const struct tm *local, time_t start)
+{
+    struct tm start_local;
+    localtime_r(&start, &start_local);
+
+    // Whole days between the two local dates, independent of DST length.
+    struct tm a = {.tm_year = local->tm_year, .tm_mon = local->tm_mon, .tm_mday = local->tm_mday, .tm_hour = 12};
+    struct tm b = {.tm_year = start_local.tm_year, .tm_mon = start_local.tm_mon, .tm_mday = start_local.tm_mday, .tm_hour = 12};
+
+    return (int)((timegm(&a) - timegm(&b)) / 86400);
+}
+
+// Local date of the slot a feed at device time t served: the latest feeding time at or before t.
+static void served_date(time_t t, int feeding_time, struct tm *date)
+{
+    localtime_r(&t, date);
+    if (date->tm_hour * 100 + date->tm_min < feeding_time)
+    {
+        date->tm_mday -= 1;
+    }
+    date->tm_hour = 12;
+    date->tm_min = 0;
+    date->tm_sec = 0;
+    date->tm_isdst = -1;
+    mktime(date);
+}
+
+// Real time of the feeding slot on the given local date, or -1 if that local time does not exist (DST gap).
+// A slot inside the fall back hour happens twice, isdst picks which one.
+static time_t slot_time(const struct tm *date, int feeding_time, int isdst)
+{
+    struct tm local = *date;
+    local.tm_hour = feeding_time / 100;
+    local.tm_min = feeding_time % 100;
+    local.tm_sec = 0;
+    local.tm_isdst = isdst;
+
+    struct tm check = local;
+    time_t slot = mktime(&check);
+    if (check.tm_hour != local.tm_hour || check.tm_min != local.tm_min)
+    {
+        return -1;
+    }
+
+    return slot;
+}
+
+static int64_t slot_offset_us(const struct tm *date, int feeding_time, int64_t true_us)
+{
+    int64_t best_us = -1;
+    for (int isdst = 0; isdst <= 1; isdst++)
+    {
+        time_t slot = slot_time(date, feeding_time, isdst);
+        if (slot < 0)
+        {
+            continue;
+        }
+
+        int64_t offset_us = llabs(true_us - (int64_t)slot * US_PER_SEC);
+        if (best_us < 0 || offset_us < best_us)
+        {
+            best_us = offset_us;
+        }
+    }
+
+    return best_us < 0 ? 0 : best_us;
+}
+
+// The moves run to completion in the call, so the feeder is idle again straight away.
+void extend_bucket()
+{
+    // Days are counted by the device's clock, the offset against the true slot includes the clock error.
+    struct tm date;
+    served_date(device_time(), options.feeding_time, &date);
+    int day = day_index(&date, options.start);
+    int64_t offset_us = slot_offset_us(&date, options.feeding_time, clock_state.true_us);
+    if (offset_us > results.max_offset_us)
+    {
+        results.max_offset_us = offset_us;
+    }
+
+    if (day >= 0 && day < options.days)
+    {
+        results.feeds_per_day[day]++;
+    }
+    results.feeds++;
+    feed();
+    last_move_us = clock_state.uptime_us;
+
+    if (options.verbose)
+    {
+        time_t true_now = clock_state.true_us / US_PER_SEC;
+        struct tm local;
+        char buf[32];
+        localtime_r(&true_now, &local);
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S %Z", &local);
+        printf("feed %s (clock error %+.1fs)\n", buf, clock_state.clock_error_us / 1e6);
+    }
+}
+
+bool feeder_control_idle_for(int64_t idle_us)
+{
+    return clock_state.uptime_us - last_move_us >= idle_us;
+}
+
+bool feeder_control_prepare_deep_sleep()
+{
+    return true;
+}
+
+void feeder_control_log_jitter()
+{
+}
+
+static void boot()
+{
+    last_move_us = INT64_MIN / 2;
+    if (options.deep_sleep)
+    {
+        scheduler_start_deep_sleep();
+    }
+    else
+    {
+        scheduler_start();
+    }
+    loop_task(NULL);
+}
+
+static bool parse_args(int argc, char **argv, sim_options_t *options)
+{
+    struct tm start = {.tm_year = 2026 - 1900, .tm_mon = 0, .tm_mday = 1, .tm_isdst = -1};
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--days") == 0 && has_value)
+        {
+            options->days = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--feeding-time") == 0 && has_value)
+        {
+            options->feeding_time = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--start") == 0 && has_value)
+        {
+            if (sscanf(argv[++i], "%d-%d-%d", &start.tm_year, &start.tm_mon, &start.tm_mday) != 3)
+            {
+                return false;
+            }
+            start.tm_year -= 1900;
+            start.tm_mon -= 1;
+        }
+        else if (strcmp(argv[i], "--drift-ppm") == 0 && has_value)
+        {
+            options->drift_ppm = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fail-every") == 0 && has_value)
+        {
+            options->fail_every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tz") == 0 && has_value)
+        {
+            setenv("TZ", argv[++i], 1);
+            tzset();
+        }
+        else if (strcmp(argv[i], "--deep-sleep") == 0)
+        {
+            options->deep_sleep = true;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0)
+        {
+            options->verbose = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Power on just after local midnight.
+    start.tm_sec = 1;
+    options->start = mktime(&start);
+
+    return options->days > 0 && options->feeding_time % 100 < 60 && options->feeding_time < 2400;
+}
+
+int main(int argc, char **argv)
+{
+    options = (sim_options_t){
+        .days = 365,
+        .feeding_time = CONFIG_FEEDING_TIME,
+        .drift_ppm = 40,
+        .fail_every = 5,
+    };
+
+    setenv("TZ", CONFIG_TIMEZONE, 1);
+    tzset();
+
+    if (!parse_args(argc, argv, &options))
+    {
+        fprintf(stderr, "usage: %s [--days N] [--feeding-time HHMM] [--start YYYY-MM-DD] [--drift-ppm N] [--fail-every N] [--tz POSIX_TZ] [--deep-sleep] [--verbose]\n", argv[0]);
+        return 2;
+    }
+
+    host_config.feeding_time = options.feeding_time;
+    strncpy(host_config.timezone, getenv("TZ"), sizeof(host_config.timezone) - 1);
+    results = (sim_results_t){
+        .last_isdst = -1,
+        .feeds_per_day = calloc(options.days + 1, sizeof(int)),
+    };
+    clock_state = (sim_clock_t){
+        .true_us = (int64_t)options.start * US_PER_SEC,
+        .rng = 1,
+    };
+    end = options.start + (time_t)options.days * 86400;
+    reset_reason = ESP_RST_POWERON;
+    mock_hal_reset(false);
+    feeder_motion_start_callibration();
+    run_move();
+
+    // A slot that passed while booting is not owed.
+    struct tm first_date;
+    localtime_r(&options.start, &first_date);
+    time_t first_slot = slot_time(&first_date, options.feeding_time, -1);
+    int64_t first_boot_us = clock_state.true_us + SYNC_DURATION_US;
+    int first_day = first_slot >= 0 && first_slot * US_PER_SEC < first_boot_us ? 1 : 0;
+
+    clock_t cpu_start = clock();
+    setjmp(power_cycle);
+    if (!finished)
+    {
+        boot();
+    }
+
+    int failed_days = 0;
+    for (int day = first_day; day < options.days; day++)
+    {
+        if (results.feeds_per_day[day] != 1)
+        {
+            time_t t = options.start + (time_t)day * 86400 + 43200;
+            struct tm local;
+            char buf[16];
+            localtime_r(&t, &local);
+            strftime(buf, sizeof(buf), "%Y-%m-%d", &local);
+            printf("FAIL %s: %d feeds\n", buf, results.feeds_per_day[day]);
+            failed_days++;
+        }
+    }
+
+    double cpu_s = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+    printf("%d days, %ld ticks (%d from deep sleep), %d feeds, %d refills, %d syncs (%d failed), %d DST changes, max slot offset %.1fs, %.2fs cpu\n",
+           options.days, results.ticks, results.deep_sleeps, results.feeds, results.refills, results.syncs, results.failed_syncs, results.dst_changes,
+           results.max_offset_us / 1e6, cpu_s);
+
+    bool ok = failed_days == 0 && results.invalid_coil_states == 0;
+    printf("%s\n", ok ? "OK" : "FAIL");
+    free(results.feeds_per_day);
+
+    return ok ? 0 : 1;
+}
@@ -3,10 +3,19 @@
 #include <time.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_console.h"
 
 #include "wifi_time.h"
 #include "scheduler.h"
 #include "feeder_control.h"
+#include "telemetry.h"
+#include "energy.h"
+#include "trace.h"
+#include "boot_stages.h"
+#include "feeder_config.h"
+#include "diagnostics.h"
+#include "ota_update.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -20,10 +29,107 @@ static void indicate_failure()
     esp_restart();
 }
 
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+static esp_err_t IRAM_ATTR on_light_sleep_enter(int64_t sleep_time_us, void *arg)
+{
+    trace_record_timed(TRACE_EVT_SLEEP_ENTER, sleep_time_us / 1000 > UINT16_MAX ? UINT16_MAX : sleep_time_us / 1000);
+    energy_begin(ENERGY_STATE_SLEEP);
+
+    return ESP_OK;
+}
+
+static esp_err_t IRAM_ATTR on_light_sleep_exit(int64_t sleep_time_us, void *arg)
+{
+    energy_end(ENERGY_STATE_SLEEP);
+    diagnostics_record_wakeup(esp_sleep_get_wakeup_cause(), false);
+    trace_record_timed(TRACE_EVT_SLEEP_EXIT, sleep_time_us / 1000 > UINT16_MAX ? UINT16_MAX : sleep_time_us / 1000);
+
+    return ESP_OK;
+}
+#endif
+
+static void init_power_management()
+{
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_PM_MIN_FREQ_MHZ,
+#ifdef CONFIG_SLEEP_ACTIVE
+        .light_sleep_enable = true,
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t sleep_cbs = {
+        .enter_cb = on_light_sleep_enter,
+        .exit_cb = on_light_sleep_exit,
+    };
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&sleep_cbs));
+#endif
+#endif
+}
+
+static void init_console()
+{
+#ifdef CONFIG_CONSOLE_ACTIVE
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "feeder>";
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    esp_err_t err = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "No console: %s", esp_err_to_name(err));
+        return;
+    }
+
+    esp_console_register_help_command();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(feeder_config_register_commands());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(diagnostics_register_commands());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(feeder_control_register_commands());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(wifi_time_register_commands());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(trace_register_commands());
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_console_start_repl(repl));
+#endif
+}
+
 void app_main(void)
 {
     esp_log_level_set("*", ESP_LOG_INFO);
+    boot_stages_init();
+
+    // Everything after this reads its settings from the store.
+    boot_stage_begin(BOOT_STAGE_CONFIG);
+    esp_err_t err = feeder_config_init();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(err);
+    boot_stage_done(BOOT_STAGE_CONFIG, err == ESP_OK);
 
+    boot_stage_begin(BOOT_STAGE_POWER);
+    init_power_management();
+    energy_init();
+    diagnostics_init();
+    boot_stage_done(BOOT_STAGE_POWER, true);
+
+    // Motor and buttons first, so manual feeds work while audio and the time sync come up in the background.
+    boot_stage_begin(BOOT_STAGE_MOTOR);
     feeder_control_init();
+    boot_stage_done(BOOT_STAGE_MOTOR, true);
+
+    boot_stage_begin(BOOT_STAGE_TELEMETRY);
+    err = telemetry_init();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(err);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(wifi_time_register_online_cb(telemetry_flush));
+    boot_stage_done(BOOT_STAGE_TELEMETRY, err == ESP_OK);
+
+#ifdef CONFIG_OTA_ACTIVE
+    // After the telemetry upload, so a slow patch download never holds the events back.
+    ESP_ERROR_CHECK_WITHOUT_ABORT(wifi_time_register_online_cb(ota_update_check));
+#endif
+
+    // Before the scheduler, so console feeds work while audio init runs.
+    init_console();
+
+    // Starts the time stage in the scheduler loop task, then runs audio init on this task before returning.
     scheduler_start();
 }
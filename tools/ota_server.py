@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Local stand-in for the OTA endpoint.  Serves delta patches from any known base image to the target image.
+
+The device sends the ELF SHA-256 of its running image.  It gets 204 if it is already on the target, 200 with a
+patch and an X-Image-Sha256 header for a known base, and 404 otherwise.  Patches are generated once at startup
+with esp_delta_ota_patch_gen.py from the esp_delta_ota component.
+
+Usage: ota_server.py --target build/new.bin --base old.bin [--base older.bin] [--port 8070] [--corrupt]
+"""
+import argparse
+import hashlib
+import os
+import subprocess
+import sys
+import tempfile
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+# esp_image_header_t (24 bytes) and the first segment header (8 bytes) come before esp_app_desc_t, which holds
+# the ELF digest 144 bytes in.
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_MAGIC = 0xABCD5432
+ELF_SHA_OFFSET = APP_DESC_OFFSET + 144
+ELF_SHA_LEN = 32
+
+DEFAULT_PATCH_GEN = "managed_components/espressif__esp_delta_ota/examples/https_delta_ota/tools/esp_delta_ota_patch_gen.py"
+
+
+def elf_sha(image):
+    magic = int.from_bytes(image[APP_DESC_OFFSET:APP_DESC_OFFSET + 4], "little")
+    if magic != APP_DESC_MAGIC:
+        raise ValueError("no app description, not an app image?")
+    return image[ELF_SHA_OFFSET:ELF_SHA_OFFSET + ELF_SHA_LEN].hex()
+
+
+def make_patch(patch_gen, base_path, target_path):
+    with tempfile.TemporaryDirectory() as tmp:
+        patch_path = os.path.join(tmp, "patch.bin")
+        subprocess.run([sys.executable, patch_gen, "create_patch", "--chip", "esp32", "--base_binary", base_path,
+                        "--new_binary", target_path, "--patch_file_name", patch_path], check=True)
+        with open(patch_path, "rb") as f:
+            return f.read()
+
+
+def make_handler(target_sha, image_sha, patches, corrupt):
+    class OtaHandler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            device_sha = self.headers.get("X-Elf-Sha256", "")
+            version = self.headers.get("X-App-Version", "?")
+            # Matched as a prefix, so a truncated digest still works.
+            if target_sha.startswith(device_sha) and device_sha:
+                print("%s on %s is up to date" % (self.client_address[0], version))
+                self.send_response(204)
+                self.end_headers()
+                return
+
+            patch = next((p for sha, p in patches.items() if device_sha and sha.startswith(device_sha)), None)
+            if patch is None:
+                print("%s on %s (%s) has no known base" % (self.client_address[0], version, device_sha))
+                self.send_response(404)
+                self.end_headers()
+                return
+
+            if corrupt:
+                patch = bytearray(patch)
+                patch[len(patch) // 2] ^= 0xFF
+            print("%s on %s gets a %d byte patch" % (self.client_address[0], version, len(patch)))
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(patch)))
+            self.send_header("X-Image-Sha256", image_sha)
+            self.end_headers()
+            self.wfile.write(patch)
+
+    return OtaHandler
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8070)
+    parser.add_argument("--target", required=True, help="image to update to")
+    parser.add_argument("--base", action="append", default=[], help="image a device may be running, repeatable")
+    parser.add_argument("--patch-gen", default=DEFAULT_PATCH_GEN, help="path to esp_delta_ota_patch_gen.py")
+    parser.add_argument("--corrupt", action="store_true", help="flip a byte in every patch to test rejection")
+    args = parser.parse_args()
+
+    with open(args.target, "rb") as f:
+        target = f.read()
+    target_sha = elf_sha(target)
+
+    patches = {}
+    for base_path in args.base:
+        with open(base_path, "rb") as f:
+            base_sha = elf_sha(f.read())
+        patch = make_patch(args.patch_gen, base_path, args.target)
+        print("%s: %d byte patch against %d byte target" % (base_path, len(patch), len(target)))
+        patches[base_sha] = patch
+
+    HTTPServer(("", args.port), make_handler(target_sha, hashlib.sha256(target).hexdigest(), patches, args.corrupt)).serve_forever()
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Local stand-in for the telemetry endpoint.  Decodes and prints each uploaded batch.
+
+Usage: telemetry_server.py [--port 8080] [--status 200]
+"""
+import argparse
+import struct
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+BATCH_MAGIC = 0x31544246
+BATCH_HEADER = struct.Struct("<II")
+RECORD = struct.Struct("<IHBB")
+
+EVENTS = ["boot", "feed", "calibrate", "button", "sync", "brownout"]
+
+
+def decode_batch(body):
+    magic, count = BATCH_HEADER.unpack_from(body, 0)
+    if magic != BATCH_MAGIC:
+        raise ValueError("bad batch magic 0x%08x" % magic)
+    if len(body) != BATCH_HEADER.size + count * RECORD.size:
+        raise ValueError("length %d does not match %d records" % (len(body), count))
+
+    for i in range(count):
+        timestamp, arg, event, check = RECORD.unpack_from(body, BATCH_HEADER.size + i * RECORD.size)
+        if check != (~event & 0xFF):
+            raise ValueError("record %d failed check" % i)
+        name = EVENTS[event] if event < len(EVENTS) else "unknown(%d)" % event
+        yield timestamp, name, arg
+
+
+def make_handler(status):
+    class TelemetryHandler(BaseHTTPRequestHandler):
+        def do_POST(self):
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            try:
+                records = list(decode_batch(body))
+            except (ValueError, struct.error) as e:
+                print("rejected batch: %s" % e)
+                self.send_response(400)
+                self.end_headers()
+                return
+
+            print("batch of %d events from %s" % (len(records), self.client_address[0]))
+            for timestamp, name, arg in records:
+                print("  %s  %-10s %d" % (time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(timestamp)), name, arg))
+
+            self.send_response(status)
+            self.end_headers()
+
+    return TelemetryHandler
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--status", type=int, default=200, help="status to reply with, non-2xx keeps the ring on the device")
+    args = parser.parse_args()
+
+    HTTPServer(("", args.port), make_handler(args.status)).serve_forever()
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Decode a trace ring dump captured from the console into a timeline.
+
+Usage: trace_decode.py [monitor.log]   (reads stdin when no file is given)
+
+Cycle counters are per core, wrap every 2^32 cycles, stop during light sleep
+and slow down with frequency scaling.  Events recorded with
+trace_record_timed() are followed by their esp_timer time, so every other
+event is placed from the previous one of those on its core and times are
+microseconds since boot.  Those other events are only recorded while the CPU
+is held at its maximum frequency, the one on the TRACE BEGIN line.  A core
+with no timed events is shown relative to its first event.
+"""
+import argparse
+import statistics
+import struct
+import sys
+
+ENTRY = struct.Struct("<IHBB")
+
+EVENTS = {
+    1: "step",
+    2: "button_isr",
+    3: "keyframe",
+    4: "sleep_enter",
+    5: "sleep_exit",
+    6: "wifi",
+}
+TIME_EVENT = 7
+
+# Longer step gaps are treated as the start of a new move.
+MOVE_GAP_US = 100000
+
+WIFI_EVENTS = {
+    2: "sta_start",
+    3: "sta_stop",
+    4: "sta_connected",
+    5: "sta_disconnected",
+    0x100: "got_ip",
+}
+
+
+def read_dump(lines):
+    ticks_per_us = None
+    entries = []
+    for line in lines:
+        idx = line.find("TRACE ")
+        if idx < 0:
+            continue
+        fields = line[idx:].split()
+        if fields[1] == "BEGIN":
+            ticks_per_us = int(fields[2])
+            entries = []
+        elif fields[1] == "END":
+            break
+        elif ticks_per_us is not None:
+            for word in fields[1:]:
+                entries.append(ENTRY.unpack(bytes.fromhex(word)))
+
+    if ticks_per_us is None:
+        raise ValueError("no TRACE BEGIN line found")
+
+    return ticks_per_us, entries
+
+
+def timestamps(entries, ticks_per_us):
+    """Time in us of each event, leaving out the time entries themselves.
+
+    Consecutive events on a core are assumed to be less than one counter wrap apart, except that a time entry
+    re-anchors its core.  Events before the first time entry on a core are worked back from it.
+    """
+    events = []
+    anchors = {}
+    for i, (cycles, arg, event, core) in enumerate(entries):
+        if event != TIME_EVENT:
+            events.append([None, cycles, arg, event, core])
+        elif events and events[-1][4] == core and i > 0 and entries[i - 1][2] != TIME_EVENT:
+            # Claimed together with the event before it, so the pair is never split except at the ring start.
+            events[-1][0] = ((arg << 32) | cycles)
+            anchors.setdefault(core, len(events) - 1)
+
+    last = {}
+    for ev in events:
+        core = ev[4]
+        if ev[0] is not None:
+            last[core] = (ev[1], ev[0])
+        elif core in last:
+            prev_cycles, prev_us = last[core]
+            ev[0] = prev_us + ((ev[1] - prev_cycles) & 0xFFFFFFFF) / ticks_per_us
+            last[core] = (ev[1], ev[0])
+
+    # Walk back from the first anchor on each core, or from the first event when there is none.
+    for core in {ev[4] for ev in events}:
+        first = anchors.get(core)
+        if first is None:
+            first = next(i for i, ev in enumerate(events) if ev[4] == core)
+            events[first][0] = 0.0
+            following = [ev for ev in events[first + 1:] if ev[4] == core]
+            prev_cycles, prev_us = events[first][1], 0.0
+            for ev in following:
+                ev[0] = prev_us + ((ev[1] - prev_cycles) & 0xFFFFFFFF) / ticks_per_us
+                prev_cycles, prev_us = ev[1], ev[0]
+        next_cycles, next_us = events[first][1], events[first][0]
+        for ev in reversed([ev for ev in events[:first] if ev[4] == core]):
+            ev[0] = next_us - ((next_cycles - ev[1]) & 0xFFFFFFFF) / ticks_per_us
+            next_cycles, next_us = ev[1], ev[0]
+
+    return [tuple(ev) for ev in events]
+
+
+def describe(event, arg):
+    name = EVENTS.get(event, "unknown(%d)" % event)
+    if event == 6:
+        return name, WIFI_EVENTS.get(arg, "event %d" % arg)
+    if event == 1:
+        return name, "pos %d" % struct.unpack("<h", struct.pack("<H", arg))[0]
+    if event == 3:
+        return name, "%d Hz" % arg
+
+    return name, str(arg)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    args = parser.parse_args()
+
+    ticks_per_us, entries = read_dump(args.log)
+    timeline = timestamps(entries, ticks_per_us)
+    if not timeline:
+        print("trace is empty")
+        return
+
+    last_step = {}
+    step_intervals = []
+    for t_us, cycles, arg, event, core in timeline:
+        name, detail = describe(event, arg)
+        print("%14.1f us  core %d  %-12s %s" % (t_us, core, name, detail))
+
+        if event == 1:
+            interval = t_us - last_step[core] if core in last_step else None
+            if interval is not None and interval < MOVE_GAP_US:
+                step_intervals.append(interval)
+            last_step[core] = t_us
+        elif event == 4:
+            last_step.clear()
+
+    if len(step_intervals) > 1:
+        print()
+        print("step interval us: n=%d min=%.1f mean=%.1f max=%.1f stdev=%.1f" % (
+            len(step_intervals),
+            min(step_intervals),
+            statistics.mean(step_intervals),
+            max(step_intervals),
+            statistics.stdev(step_intervals)))
+
+
+if __name__ == "__main__":
+    main()